@@ -12,15 +12,60 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 #include <locale.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 /*** defines ***/
 
 #define TECS_TAB_STOP 8 //length of a tab. 8 bytes
+#define TECS_LONG_LINE 4096 //rows longer than this are never rendered whole, only the visible part is
 #define TECS_QUIT_TIMES 1
+#define ROW_MAPPED 0x01 //chars point into the memory mapped file and are not owned by the row
+#define ROW_ALIAS 0x02 //the row has no tabs, so render points to chars instead of an own buffer
+#define ROW_HL 0x04 //hlout is the highlight state at the end of the row when it starts in state hlin
+#define ROW_UTF8 0x08 //the row has non-ASCII characters, so its bytes aren't its columns. Valid while rendered
+#define TECS_LOAD_CHUNK (1 << 20) //bytes of the file scanned for newlines by one loader task
+#define TECS_LOAD_THREADS 8 //maximum number of loader threads
+#define TECS_LOAD_STEP 65536 //rows created per loader step between two keypress checks
+#define TECS_SAVE_BATCH 512 //rows written with one writev() call
+#define TECS_SAVE_FSYNC 1 //1 to fsync a saved file before it replaces the original
+#define TECS_SEARCH_SYNC (1 << 20) //bytes searched while the key is handled, the search thread does the rest
+#define TECS_REPLACE_THREADS 8 //maximum number of threads which look for the matches of a replace
+#define TECS_REPLACE_BATCH 65536 //rows searched by the replace threads before their changes are applied
+#define TECS_TEXT_MIN 16 //smallest slot for row text in the text arenas
+#define TECS_TEXT_MAX 4096 //row text larger than this is allocated with malloc()
+#define TECS_TEXT_CLASSES 9 //slot sizes 16, 32, ..., 4096
+#define TECS_TEXT_ARENA (1 << 20) //size of one text arena
+#define TECS_UNDO_LIMIT (64 << 20) //bytes the undo journal may use, older changes are forgotten
+#define TECS_AUTOSAVE_IDLE 1000 //milliseconds without edits before the changes are written to the journal
+#define TECS_AUTOSAVE_BATCH (64 << 10) //bytes of changes which are written to the journal without waiting
+#define TECS_FOLLOW_STEP (4 << 20) //bytes a followed file is read per event loop turn
+#define TECS_FOLLOW_POLL 1000 //milliseconds between checks of a followed file without inotify
+#define TECS_VIEW_CACHE 64 //megabytes of row memory of --view, half of it holds the window of the file
+#define TECS_VIEW_STRIDE 1024 //lines between two entries of the line index of --view
+#define TECS_HL_SYNC 500 //rows above the screen the highlighting starts from when their state isn't known
+#define TECS_HUD_SAMPLES 128 //number of recent keys the HUD computes percentiles from
+#define TECS_STATUS_TIMEOUT 5000 //milliseconds a status message is shown before the info bar returns
+#define TECS_TRACE_EVENTS (1 << 18) //spans kept by --trace, older ones are overwritten
 #define RED "\033[0;31m"
 #define reset "\033[0m"
 #define TECS_VERSION RED"  Final"reset
@@ -36,23 +81,338 @@ enum keys {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    PASTE //a bracketed paste, the text is in E.paste
 };
 time_t raw_time;
 struct tm *info;
 
 /*** data ***/
 
+/**
+ * A tab or a non-ASCII character whose last byte is at chars index cx and which ends at render column rx.
+ */
+typedef struct tabStop {
+    int cx;
+    int rx;
+} tabStop;
+
+/**
+ * Column index of a long row: the characters which aren't one byte and one column wide in order, complete
+ * for the chars in front of scanned.
+ */
+typedef struct colIndex {
+    int n; //number of stops
+    int cap;
+    int scanned;
+    tabStop stops[];
+} colIndex;
+
 /**
  * erow stores line of text as a pointer to the dynamically-allocated char data and a length.
  */
 typedef struct erow {
     int size;
     int rsize; //size of the contents of render
-    char *chars;
-    char *render; //contains the characters to draw on the screen for that row of text
+    int rcap; //allocated size of render if it is an own buffer
+    int tabs; //number of tabs in chars, valid while render is not NULL
+    unsigned short flags; //ROW_ flags
+    unsigned char hlin, hlout; //highlight state at the start and at the end of the row, valid while ROW_HL
+    int ccap; //allocated size of chars, 0 while the row is ROW_MAPPED
+    char *chars; //not null terminated while the row is ROW_MAPPED
+    char *render; //contains the characters to draw on the screen for that row of text, NULL until needed
+    unsigned char *hl; //highlight of every character of render, NULL until the row is drawn with a syntax
+    colIndex *colidx; //column index of a long row, NULL until needed
 } erow;
 
+#define TECS_ROW_BLOCK 64 //number of rows stored in one block of the row tree
+
+/**
+ * The rows of the file are stored in blocks of up to TECS_ROW_BLOCK consecutive rows. The blocks are the
+ * nodes of a treap which is ordered by position and every node knows how many rows and bytes its subtree
+ * holds. Finding, inserting and deleting a row therefore costs O(log n) instead of moving the whole row
+ * array, and so does turning a line number into a byte offset of the file and back.
+ */
+typedef struct rowBlock {
+    struct rowBlock *left, *right, *parent;
+    unsigned int priority; //random heap priority which keeps the treap balanced
+    int nrows; //number of rows in the subtree of this block
+    int count; //number of rows stored in this block
+    long long nbytes; //bytes of the rows in the subtree of this block, every row with its newline
+    long long bytes; //bytes of the rows stored in this block
+    erow rows[TECS_ROW_BLOCK];
+} rowBlock;
+
+/**
+ * Position of a walk through the rows: a block and the index of its first row.
+ */
+typedef struct rowIter {
+    rowBlock *block;
+    int start;
+} rowIter;
+
+/**
+ * One chunk of the mapped file. A loader thread stores the offsets of all newlines in the chunk,
+ * the main thread turns them into rows once done is set.
+ */
+typedef struct loadChunk {
+    size_t begin, end; //byte range of the chunk inside E.map
+    uint32_t *lines; //offsets of the newlines relative to begin
+    int nlines;
+    int cap;
+    atomic_int done; //set by the loader thread when lines is complete
+} loadChunk;
+
+/**
+ * Big block of memory the text of rows is cut from.
+ */
+typedef struct textArena {
+    struct textArena *next;
+    char data[];
+} textArena;
+
+/**
+ * Allocator for the text of rows. Slots are cut from arenas of TECS_TEXT_ARENA bytes in size classes
+ * of powers of two, freed slots are kept in a free list per class. A slot has no header, so a short
+ * row costs exactly one 16 byte slot.
+ */
+struct textHeap {
+    textArena *arenas; //all arenas, new slots are cut from the first one
+    char *cur, *end; //unused part of the first arena
+    void *free[TECS_TEXT_CLASSES]; //free slots of each class, linked through their first bytes
+    size_t arenabytes; //size of all arenas
+    size_t usedbytes; //size of all slots in use
+    size_t largebytes; //size of the text allocated with malloc()
+};
+
+enum undoType {
+    UNDO_INSERT, //characters inserted into a row
+    UNDO_DELETE, //characters deleted from a row
+    UNDO_INSERT_ROWS, //rows inserted
+    UNDO_DELETE_ROWS, //rows deleted
+    UNDO_REPLACE //every occurrence of a text replaced with another one
+};
+
+/**
+ * One change in the undo journal.
+ */
+typedef struct undoRecord {
+    int type; //undoType
+    int group; //changes with the same group are undone together
+    int row, col; //where the change happened
+    int nrows; //number of rows of UNDO_INSERT_ROWS and UNDO_DELETE_ROWS, of matches of UNDO_REPLACE
+    int len, cap; //length and allocated size of text
+    char *text; //the inserted or deleted characters, rows are separated by '\n'. For UNDO_REPLACE the lengths
+                //of both texts as ints, the texts and the row and column of every match before the replacement
+    int cx, cy; //cursor before the group
+    int acx, acy; //cursor after the group
+} undoRecord;
+
+struct undoStack {
+    undoRecord *recs;
+    int n, cap;
+};
+
+/**
+ * Undo and redo journal. Every key is a group of changes, runs of typing are merged into one record.
+ */
+struct undoJournal {
+    struct undoStack undo, redo;
+    size_t bytes; //memory used by the records of both stacks
+    int group; //group of the key being handled, 0 while changes are not recorded
+    int prevgroup; //group of the previous key
+    int groups; //number of groups so far
+    int skip; //group which is not recorded because it exceeds TECS_UNDO_LIMIT
+    int cx, cy; //cursor when the key began
+    int replaying; //1 while records are undone or redone
+};
+
+/**
+ * Autosave journal. Every change to the rows is appended as a record to E.autosave.pending and written
+ * by the autosave thread to a journal file next to the file, so the changes since the last save survive
+ * a crash. The journal starts with the size and modification time of the file it applies to.
+ */
+struct autosave {
+    char *path; //journal file, NULL while the file has no name
+    int started; //1 once the journal has its header
+    int truncate; //1 if the journal must be emptied before pending is written
+    int replaying; //1 while the journal is replayed, the changes are already in it
+    char *pending; //records not handed to the thread yet
+    int plen, pcap;
+    int running; //1 while the thread exists
+    pthread_t thread;
+    pthread_mutex_t lock; //protects the fields below
+    pthread_cond_t wake;
+    char *queued; //records the thread writes next
+    int qlen, qcap;
+    int restart; //1 if the thread must empty the journal first, and delete it if nothing follows
+    int stop;
+};
+
+/**
+ * Start of the journal file.
+ */
+typedef struct autosaveHeader {
+    char magic[8];
+    long long size; //size of the file the records apply to
+    long long mtime; //modification time of that file in nanoseconds
+} autosaveHeader;
+
+/**
+ * A record of the journal, followed by len bytes of text. type is one of the undo record types.
+ */
+typedef struct autosaveEntry {
+    int type, row, col, len;
+} autosaveEntry;
+
+#define AUTOSAVE_MAGIC "teCSjr1"
+
+/**
+ * Follow mode (--follow). Bytes appended to the file are read from offset on and turned into rows at the
+ * end, like tail -F. inotify tells when the file changes, its directory when the file gets replaced.
+ */
+struct follow {
+    int on;
+    int fd; //the followed file, -1 while it is missing
+    off_t offset; //bytes of fd already turned into rows
+    int open; //1 if the last row had no newline yet, new bytes continue it
+    int pending; //1 if there may be bytes which were not read yet
+    int inotify; //inotify instance, -1 if there is none
+    int wdfile, wddir; //watches of the file and of its directory
+    char *buf;
+};
+
+/**
+ * Read-only pager (--view) for files larger than the memory. Only a window of the file around the
+ * cursor is turned into rows; the rows point into buf. A thread builds a sparse index of line
+ * offsets in the background, so line numbers can be shown and jumped to without reading everything.
+ */
+struct view {
+    int on;
+    int fd;
+    off_t size; //size of the file
+    off_t start, end; //bytes of the file which are rows now
+    off_t loaded; //offset the window was last loaded for, -1 before the first load
+    long long firstline; //number of the first row in the file, -1 while it isn't known yet
+    size_t window; //maximum size of the window
+    size_t maxrows; //maximum number of rows of the window, they take the other half of the cache
+    char *buf;
+    pthread_t thread; //builds the line index
+    pthread_mutex_t lock; //protects index
+    off_t *index; //index[k] is the offset of line k * TECS_VIEW_STRIDE
+    size_t nindex, capindex;
+    atomic_llong indexed; //bytes of the file indexed so far
+    atomic_llong lines; //lines of the file, -1 until the index is complete
+    atomic_int stop;
+};
+
+enum hudPhase {
+    HUD_INPUT, //decoding the key
+    HUD_EDIT, //handling the key
+    HUD_SCROLL, //scroll()
+    HUD_BUILD, //building the frame
+    HUD_WRITE, //writing the frame to the terminal
+    HUD_PHASES
+};
+
+/**
+ * Performance HUD. While it is on, the time of every phase of handling a key is measured and shown
+ * in an extra line below the message bar. While it is off, nothing is measured.
+ */
+struct hud {
+    int on;
+    long long mark; //nanoseconds when the current phase began
+    long long frame[HUD_PHASES]; //nanoseconds spent in each phase since the last frame
+    long long last[HUD_PHASES]; //nanoseconds of each phase of the last key
+    long long samples[HUD_PHASES][TECS_HUD_SAMPLES]; //recent keys
+    int nsamples, next;
+    int keys; //number of keys handled since the last frame
+    size_t framebytes; //bytes written by the last frame
+};
+
+enum timers {
+    TIMER_STATUS, //status message expiry
+    TIMER_AUTOSAVE, //idle autosave
+    TIMER_FOLLOW, //check of a followed file, and redraw of its status
+    TIMERS
+};
+
+/**
+ * A timer of the event loop. fire is called by the event loop once monotonicMs() reaches due.
+ */
+struct timer {
+    long long due; //0 while the timer is not armed
+    void (*fire)();
+};
+
+/**
+ * A span recorded by --trace. seq is written last, so a span that is still being written is skipped.
+ */
+typedef struct traceEvent {
+    atomic_ullong seq; //number of the span + 1 once it is complete
+    const char *name;
+    long long start, dur; //nanoseconds
+    int tid;
+} traceEvent;
+
+/**
+ * Span tracing. Every thread appends its spans to the ring without locking by claiming a slot with
+ * next. At exit the ring is written as Chrome trace event JSON.
+ */
+struct trace {
+    int on;
+    char *path; //file the trace is written to
+    traceEvent *ring;
+    atomic_ullong next; //number of the next span
+    atomic_int threads; //thread ids handed out so far
+    long long epoch; //nanoseconds when tracing started
+};
+
+/**
+ * State of a file which is still being loaded. Rows are created chunk by chunk
+ * while the editor is already usable.
+ */
+struct loader {
+    int active; //1 while not all rows of the file exist yet
+    loadChunk *chunks;
+    int nchunks;
+    atomic_int next; //next chunk a loader thread claims
+    atomic_int lines; //number of newlines found so far
+    int stitched; //number of chunks completely turned into rows
+    int line; //next newline of chunks[stitched] to turn into a row
+    size_t pos; //offset of the start of the next row in E.map
+    int at; //row index where the next row is inserted, moves with rows inserted or deleted before it
+    pthread_t threads[TECS_LOAD_THREADS];
+    int nthreads;
+};
+
+/**
+ * A search which runs in its own thread while the search prompt is open. The thread only reads the rows,
+ * which can't change while the prompt is open, and creating rows by the loader waits for it.
+ */
+struct searchJob {
+    int active; //1 while the search prompt has a query, the status bar shows the progress
+    pthread_t thread;
+    int running; //1 while the thread has to be joined
+    char *query; //copy of the query the thread searches for, NULL if there is no search
+    int len;
+    int icase;
+    int isregex; //1 if the query is a regular expression
+    const char *error; //why the query is not a valid regular expression, NULL if it is
+    int row, col, direction; //where the thread starts looking for the match
+    int numrows;
+    atomic_int cancel; //set to stop the thread
+    atomic_int found; //0 while looking, 1 if found (foundrow, foundcol), -1 if the file has no match
+    int foundrow, foundcol;
+    atomic_int total; //number of matches counted so far
+    atomic_int before; //number of matches before the found one, -1 until known
+    atomic_int done; //1 when all matches are counted
+    int applied; //1 once the cursor has been moved to the found match
+    int k; //number of the match under the cursor, 0 if not known yet
+    int view; //1 if the thread reads the file of --view instead of the rows
+    off_t offset, foundoff; //where the thread starts looking and the match it found, for view
+};
+
 /**
  * This struct sets up a global struct that will contain our editor state,
  * which we’ll use to store the width and height of the terminal.
@@ -64,10 +424,31 @@ struct editorConfig {
     int coloff; //keeps track of what column the user is currently scrolled to
     int screenrows; //for the rows
     int screencols; //for the cols
+    int numbers; //1 while the line numbers are shown
+    int gutter; //width of the line number gutter left of the text, 0 while it is hidden
+    long long gutterlimit; //the gutter is wide enough for line numbers below this
     int numrows; //num of rows
-    erow *row; //
+    const struct syntax *syntax; //highlighting of the file type, NULL for plain text
+    int hlvalid; //the highlight states of all rows above this one are known to be right
+    rowBlock *rowroot; //root of the row tree
+    rowIter rowcache; //block of the last row lookup, makes walking through consecutive rows O(1)
     int dirty; // after safe checks if theres a modification
     char *filename; // name of the file
+    char *map; //memory mapping of the opened file, mapped rows point into it
+    size_t mapsize; //length of the mapping
+    dev_t mapdev; //device and inode of the file map is a mapping of, mapino is 0 if it is anonymous memory
+    ino_t mapino;
+    struct loader load; //progressive loading of the mapped file
+    struct searchJob search; //background search of the search prompt
+    struct textHeap text; //memory of the row text
+    struct undoJournal undo;
+    struct autosave autosave; //crash recovery journal
+    struct follow follow; //tail -F of the file
+    struct view view; //read-only pager
+    struct hud hud; //performance HUD
+    struct trace trace; //span tracing of --trace
+    struct timer timers[TIMERS];
+    int sigpipe[2]; //self-pipe, the SIGWINCH handler writes to it to wake up the event loop
     char statusmsg[80]; // message for informations
     time_t statusmsg_time;
 
@@ -83,17 +464,62 @@ struct editorConfig {
     cc_t     c_cc[NCCS]; special characters
     */
     struct termios orig_termios;
+
+    char inbuf[4096]; //input read from the terminal but not handled yet
+    int inlen, inpos;
+    char *paste; //text of the last bracketed paste
+    int pastelen, pastecap;
+
+    struct aBuffer *shadow; //what the terminal currently shows, one buffer per screen line
+    int shadowlines; //number of lines in shadow
+    int shadowrowoff, shadowcoloff; //E.rowoff and E.coloff of the shadow frame
+    int shadowcy, shadowcx; //cursor position of the shadow frame
+    int fullredraw; //1 if the next frame must repaint the whole terminal
 };
 struct editorConfig E;//stores the terminal attributes
 
 void editorSetStatusMessage(const char *fmt, ...);
 
+void setStatusMessage(const char *fmt, ...);
+
 void refreshScreen();
 
+int loaderStep(int budget);
+
+void waitForInput();
+
+long long hudNow();
+
+void traceDump();
+
+void undoRecordText(int type, int row, int col, const char *s, int len);
+
+void undoRecordRows(int type, int row, const char *s, int len);
+
+void autosaveRecord(int type, int row, int col, const char *s, int len);
+
+int writeAll(int fd, struct iovec *iov, int cnt);
+
+void searchJobCancel();
+
+int searchStatus(char *buf, int size);
+
 char *inputFileName(char *prompt, void (*callback)(char *, int));
 
+char *inputPrompt(char *prompt, void (*callback)(char *, int), int empty);
+
 char *concat(const char *s1, const char *s2);
 
+void timerStart(int id, int ms, void (*fire)());
+
+void timerStop(int id);
+
+void infoBar();
+
+void followTick();
+
+int followRead();
+
 /*** terminal ***/
 /**
  * A exit method for the program.
@@ -112,6 +538,7 @@ void quit(const char *s) {
  * attributes when we exit the program. We store the original terminal attributes in orig_termios.
  */
 void deactivateUnprocessedMode() {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8); //bracketed paste off
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
         quit("tcsetattr");
 }
@@ -165,57 +592,126 @@ void activateUnprocessedMode() {
     */
     raw_input.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG); //disables Ctrl-(C,Z,S,Q,V)
     raw_input.c_cc[VMIN] = 0; //read() returns as soon as there is any input to read
-    raw_input.c_cc[VTIME] = 1; //100 milliseconds wait before read() returns
+    raw_input.c_cc[VTIME] = 1; //100 milliseconds wait before read() returns, only used inside escape sequences
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw_input) == -1) quit("tcsetattr");
+    write(STDOUT_FILENO, "\x1b[?2004h", 8); //bracketed paste on, pastes arrive between ESC[200~ and ESC[201~
 
 }
 
 /**
- * This function waits for one keypress and returns it.
- * @return the keypress
- */
-int readKeypress() {
-    int nread;
-    char c;
-/**
- * the function read will, if it is successful, return the number of bytes read,
- * which should be 1 in this case (because that is the amount of data that was requested).
- * That is why the return value is compared with the value 1,
- * and if it is not equal, then the program quits with an error message.
+ * This function returns the next byte of input. Everything the terminal has ready is read with one
+ * read() call into E.inbuf and the following calls are served from there.
+ * @param c the byte
+ * @return 1 if a byte was read, 0 if read() timed out
  */
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+int readByte(char *c) {
+    if (E.inpos == E.inlen) {
+        int nread = read(STDIN_FILENO, E.inbuf, sizeof(E.inbuf));
         if (nread == -1 && errno != EAGAIN) { //if error eagain then quit
             quit("read");
-        };
+        }
+        if (nread <= 0) return 0;
+        E.inlen = nread;
+        E.inpos = 0;
+    }
+    *c = E.inbuf[E.inpos++];
+    return 1;
+}
+
+/**
+ * Returns 1 if more input is waiting, either in E.inbuf or on the terminal.
+ */
+int inputPending() {
+    if (E.inpos < E.inlen) return 1;
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/**
+ * This function collects the text of a bracketed paste into E.paste. It is called after ESC[200~
+ * and reads whole buffers until the closing ESC[201~, bytes behind the end marker stay in E.inbuf.
+ */
+void readPaste() {
+    static const char end[] = "\x1b[201~";
+    int endlen = sizeof(end) - 1;
+    int idle = 0;
+    E.pastelen = 0;
+    while (idle < 10) { //give up after a second without data
+        if (E.inpos == E.inlen) {
+            int nread = read(STDIN_FILENO, E.inbuf, sizeof(E.inbuf));
+            if (nread == -1 && errno != EAGAIN) quit("read");
+            if (nread <= 0) {
+                idle++;
+                continue;
+            }
+            E.inlen = nread;
+            E.inpos = 0;
+            idle = 0;
+        }
+        int avail = E.inlen - E.inpos;
+        if (E.pastelen + avail > E.pastecap) {
+            E.pastecap = (E.pastelen + avail) * 2;
+            E.paste = realloc(E.paste, E.pastecap);
+            if (E.paste == NULL) quit("realloc");
+        }
+        int from = E.pastelen > endlen ? E.pastelen - endlen : 0; //the marker may have been split
+        memcpy(&E.paste[E.pastelen], &E.inbuf[E.inpos], avail);
+        E.pastelen += avail;
+        E.inpos = E.inlen;
+        char *hit = memmem(&E.paste[from], E.pastelen - from, end, endlen);
+        if (hit) {
+            int excess = E.pastelen - (hit - E.paste) - endlen;
+            E.inpos = E.inlen - excess; //give back what follows the paste
+            E.pastelen = hit - E.paste;
+            return;
+        }
     }
+}
+
+/**
+ * This function waits for one keypress and returns it.
+ * @return the keypress, PASTE if a bracketed paste has been read into E.paste
+ */
+int readKeypress() {
+    char c;
+    if (E.inpos == E.inlen) waitForInput(); //the event loop runs until a key arrives
+    while (!readByte(&c)) waitForInput();
+    if (E.hud.on) E.hud.mark = hudNow(); //decoding starts once the key is there
     if (c == '\x1b') {
-        char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b'; //esc
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b'; //esc
+        char seq[16];
+        char f;
+        int n = 0;
+        if (!readByte(&seq[0])) return '\x1b'; //esc
         if (seq[0] == '[') {
-            if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-                if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1':
-                            return HOME_KEY;
-                        case '3':
-                            return DEL_KEY;
-                        case '4':
-                            return END_KEY;
-                        case '5':
-                            return PAGE_UP;
-                        case '6':
-                            return PAGE_DOWN;
-                        case '7':
-                            return HOME_KEY;
-                        case '8':
-                            return END_KEY;
-                    }
+            while (1) { //parameters of the sequence up to the final byte
+                if (!readByte(&f)) return '\x1b';
+                if (!isdigit(f) && f != ';') break;
+                if (n < (int) sizeof(seq) - 1) seq[n++] = f;
+            }
+            seq[n] = '\0';
+            if (f == '~') {
+                switch (atoi(seq)) {
+                    case 1:
+                        return HOME_KEY;
+                    case 3:
+                        return DEL_KEY;
+                    case 4:
+                        return END_KEY;
+                    case 5:
+                        return PAGE_UP;
+                    case 6:
+                        return PAGE_DOWN;
+                    case 7:
+                        return HOME_KEY;
+                    case 8:
+                        return END_KEY;
+                    case 200:
+                        readPaste();
+                        return PASTE;
                 }
-            } else {
-                switch (seq[1]) {
+            } else if (n == 0) {
+                switch (f) {
                     case 'A':
                         return ARROW_UP;
                     case 'B':
@@ -231,6 +727,7 @@ int readKeypress() {
                 }
             }
         } else if (seq[0] == 'O') {
+            if (!readByte(&seq[1])) return '\x1b'; //esc
             switch (seq[1]) {
                 case 'H':
                     return HOME_KEY;
@@ -288,601 +785,4994 @@ int windowSize(int *rows, int *cols) {
     }
 }
 
-/*** row operations ***/
+/*** row store ***/
 /**
- * This function converts chars index into a render index
- * @param row
- * @param cx
- * @return
+ * Returns the number of rows in the subtree of a block.
+ * @param b block or NULL
+ * @return number of rows
  */
-int cXToRx(erow *row, int cx) {
-    int rx = 0;
-    int j;
-    for (j = 0; j < cx; j++) { //loop through all the characters left of cx
-        if (row->chars[j] == '\t')
-            rx += (TECS_TAB_STOP - 1) - (rx %
-                                         TECS_TAB_STOP); //subtract the amount of columns we are right of last tab stop from amount of columns to the left of next tab stop.
-        rx++; // this gets us to the next tab stop
-    }
-    return rx;
+int blockRows(rowBlock *b) {
+    return b ? b->nrows : 0;
 }
 
 /**
- * This function converts render index into a char index
- * @param row
- * @param rx
- * @return
+ * Returns the number of bytes in the subtree of a block.
+ * @param b block or NULL
+ * @return number of bytes
  */
-int rXToCx(erow *row, int rx) {
-    int cur_rx = 0;
-    int cx;
-    for (cx = 0; cx < row->size; cx++) { //loop through the chars
-        if (row->chars[cx] == '\t')
-            cur_rx += (TECS_TAB_STOP - 1) - (cur_rx % TECS_TAB_STOP); //calculate current cx value
-        cur_rx++;
-        if (cur_rx > rx) return cx; //if current rx hits given rx value return cx
-    }
-    return cx; //if rx is out of range
+long long blockBytes(rowBlock *b) {
+    return b ? b->nbytes : 0;
 }
 
 /**
- * This function uses the chars string of a row to fill the contents of the rendered string.
- * @param row
+ * This function recalculates the row and byte counts of a block from its children.
+ * @param b
  */
-void updateRow(erow *row) {
-    int tabs = 0;
-    int j;
-    for (j = 0; j < row->size; j++)
-        if (row->chars[j] == '\t') tabs++; //we loop through the chars of the row
-    free(row->render);
-    row->render = malloc(row->size + tabs * (TECS_TAB_STOP - 1) + 1); //allocate memory for render(count of tabs)
-    int idx = 0;
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') { //checks whether the current character is a tab
-            row->render[idx++] = ' '; // if it is, we append one space
-            while (idx % TECS_TAB_STOP != 0)
-                row->render[idx++] = ' '; //append spaces until we get a tab stop, which is a column divisible by 8
-        } else {
-            row->render[idx++] = row->chars[j];
-        }
-    }
-    row->render[idx] = '\0';
-    row->rsize = idx; //contains the number of characters of row -> render
+void blockUpdate(rowBlock *b) {
+    b->nrows = b->count + blockRows(b->left) + blockRows(b->right);
+    b->nbytes = b->bytes + blockBytes(b->left) + blockBytes(b->right);
 }
 
 /**
- * This function allocates space for a new erow, and then copies the given string
- * to a new erow at the end of the E.row array. It inserts a row at the index specified by the new argument.
- * @param at
- * @param s
- * @param len
+ * This function adds delta rows and bytes bytes to a block and all of its ancestors.
+ * @param b
+ * @param delta
+ * @param bytes
  */
-void insertRow(int at, char *s, size_t len) {
-    if (at < 0 || at > E.numrows) return; //validate at
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1)); //allocate memory for one more erow
-    memmove(&E.row[at + 1], &E.row[at],
-            sizeof(erow) * (E.numrows - at)); //make room at the specified index for the new row
-
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
-
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    updateRow(&E.row[at]);
+void blockAdjust(rowBlock *b, int delta, long long bytes) {
+    b->bytes += bytes;
+    for (; b; b = b->parent) {
+        b->nrows += delta;
+        b->nbytes += bytes;
+    }
+}
 
-    E.numrows++;
-    E.dirty++;
+/**
+ * This function replaces the child old of parent with new, or the root if there is no parent.
+ */
+void blockReplaceChild(rowBlock *parent, rowBlock *old, rowBlock *new) {
+    if (new) new->parent = parent;
+    if (parent == NULL) E.rowroot = new;
+    else if (parent->left == old) parent->left = new;
+    else parent->right = new;
 }
 
 /**
- * This function frees the memory owned by row.
- * @param row
+ * This function rotates a block above its parent. The in-order position of all rows stays the same.
+ * @param x
  */
-void editorFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
+void blockRotateUp(rowBlock *x) {
+    rowBlock *p = x->parent;
+    blockReplaceChild(p->parent, p, x);
+    if (p->left == x) {
+        p->left = x->right;
+        if (p->left) p->left->parent = p;
+        x->right = p;
+    } else {
+        p->right = x->left;
+        if (p->right) p->right->parent = p;
+        x->left = p;
+    }
+    p->parent = x;
+    blockUpdate(p);
+    blockUpdate(x);
 }
 
 /**
- * This function deletes the row.
- * @param at
+ * Returns a pseudo random priority for a new block (xorshift).
  */
-void deleteRow(int at) {
-    if (at < 0 || at >= E.numrows) return; //validate the at index
-    editorFreeRow(&E.row[at]); //free memory owned by the row
-    memmove(&E.row[at], &E.row[at + 1],
-            sizeof(erow) * (E.numrows - at - 1)); //overwrite the deleted row struct with rest of rowes which come after
-    E.numrows--;
-    E.dirty++;
+unsigned int blockPriority() {
+    static unsigned int state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
 }
 
 /**
- * This function inserts a single character into a row at a given position.
- * @param row the erow we insert the character into
- * @param at the index we want to insert characters into
- * @param c position in the array
+ * This function returns the in-order successor of a block.
+ * @param b
+ * @return the next block or NULL
  */
-void insertCharInRow(erow *row, int at, int c) {
-    if (at < 0 || at > row->size) at = row->size;
-    row->chars = realloc(row->chars, row->size +
-                                     2); //allocate one more byte for the chars of erow. + 2 because making room for null byte.
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1); //memmove makes room for the new character
-    row->size++;
-    row->chars[at] = c; //assign the character to its position in the chars array
-    updateRow(row); //Update fields with the new row content
-    E.dirty++;
+rowBlock *blockNext(rowBlock *b) {
+    if (b->right) {
+        b = b->right;
+        while (b->left) b = b->left;
+        return b;
+    }
+    while (b->parent && b->parent->right == b) b = b->parent;
+    return b->parent;
 }
 
 /**
- * This function appends a string to the end of the row.
- * @param row
- * @param s
- * @param len
+ * This function allocates an empty block and links it into the tree directly after the block prev.
+ * If prev is NULL the tree must be empty and the block becomes the root.
+ * @param prev
+ * @return the new block
  */
-void appendString(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1); //allocate specified memory for row
-    memcpy(&row->chars[row->size], s, len); //copy the given string to the end of the contents
-    row->size += len; //update length
-    row->chars[row->size] = '\0';
-    updateRow(row);
-    E.dirty++; //increment dirty so that program knows that file was modified
+rowBlock *blockInsertAfter(rowBlock *prev) {
+    rowBlock *b = calloc(1, sizeof(rowBlock));
+    if (b == NULL) quit("calloc");
+    b->priority = blockPriority();
+    if (prev == NULL) {
+        E.rowroot = b;
+        return b;
+    }
+    if (prev->right == NULL) {
+        prev->right = b;
+        b->parent = prev;
+    } else {
+        rowBlock *m = prev->right;
+        while (m->left) m = m->left;
+        m->left = b;
+        b->parent = m;
+    }
+    while (b->parent && b->parent->priority < b->priority) blockRotateUp(b); //restore the heap order
+    return b;
 }
 
 /**
- * This function deletes a character in a row.
- * @param row
- * @param at
+ * This function unlinks an empty block from the tree and frees it.
+ * @param b
  */
-void rowDeleteChar(erow *row, int at) {
-    if (at < 0 || at >= row->size) return;
-    memmove(&row->chars[at], &row->chars[at + 1],
-            row->size - at); //overwrites the deleted character with the characters that come after it
-    row->size--; //decrement the row size
-    updateRow(row); //updates the rows
-    E.dirty++;
+void blockRemove(rowBlock *b) {
+    while (b->left && b->right) //rotate the block down until it has at most one child
+        blockRotateUp(b->left->priority > b->right->priority ? b->left : b->right);
+    rowBlock *child = b->left ? b->left : b->right;
+    rowBlock *parent = b->parent;
+    blockReplaceChild(parent, b, child);
+    for (; parent; parent = parent->parent) blockUpdate(parent);
+    free(b);
 }
 
 /**
- * This function deletes the character left to the cursor.
+ * This function finds the block which holds the row at index at.
+ * @param at index of the row
+ * @param start index of the first row in the returned block
+ * @return the block or NULL if at is out of range
  */
-void deleteChar() {
-    if (E.cy == E.numrows) return; //if the cursor is past the end of file, nothing to delete.
-    if (E.cx == 0 && E.cy == 0) return; //if cursor is at the beginning of the first line, nothing to do.
-    erow *row = &E.row[E.cy]; //gets the erow the cursor is on
-    if (E.cx > 0) { //if there is a character to the left of the cursor
-        rowDeleteChar(row, E.cx - 1); //delete the character and move the cursor one to the left
-        E.cx--;
-    } else {
-        E.cx = E.row[E.cy - 1].size; //set E.cx to the end of the contents of the previous row before appending
-        appendString(&E.row[E.cy - 1], row->chars, row->size); //append to the previous row
-        deleteRow(E.cy); //delete the row
-        E.cy--;
+rowBlock *blockFind(int at, int *start) {
+    rowBlock *b = E.rowroot;
+    int base = 0;
+    while (b) {
+        int l = blockRows(b->left);
+        if (at < base + l) {
+            b = b->left;
+        } else if (at < base + l + b->count) {
+            *start = base + l;
+            return b;
+        } else {
+            base += l + b->count;
+            b = b->right;
+        }
     }
+    return NULL;
 }
 
-/*** editor operations ***/
 /**
- * This function takes a character and uses editorRow() to insert that character
- * into the position that the cursor is at.
- * @param c position in the array
+ * This function returns the row at index at, remembering the block of the lookup in it.
+ * Consecutive lookups, e.g. while drawing the screen, are answered from that block.
+ * Threads which read the rows use their own rowIter.
+ * @param it
+ * @param at
+ * @return the row or NULL if at is out of range
  */
-void insertChar(int c) {
-    if (E.cy == E.numrows) { //if condition is true, then we append a new row to the file before inserting character
-        insertRow(E.numrows, "", 0);
+erow *rowIterAt(rowIter *it, int at) {
+    if (at < 0 || at >= blockRows(E.rowroot)) return NULL;
+    rowBlock *b = it->block;
+    if (b) {
+        if (at >= it->start + b->count) {
+            rowBlock *next = blockNext(b); //walking forward into the next block
+            if (next && at < it->start + b->count + next->count) {
+                it->start += b->count;
+                it->block = b = next;
+            }
+        }
+        if (at >= it->start && at < it->start + b->count)
+            return &b->rows[at - it->start];
     }
-    insertCharInRow(&E.row[E.cy], E.cx, c);
-    E.cx++; //moving the cursor forward, so that the next character we insert comes after the just inserted character
+    b = blockFind(at, &it->start);
+    it->block = b;
+    return &b->rows[at - it->start];
 }
 
 /**
- * This function allows us to add a new line or break an existing line. This is done using the Enter key.
- * If we are at the beginning of a line, we just have to insert a new empty line before the line we are in.
+ * This function returns the row at index at.
+ * The returned pointer stays valid until the next insertRow() or deleteRow().
+ * @param at
+ * @return the row or NULL if at is out of range
  */
-void insertNewline() {
-   if (E.cx == 0) { //If we are at the beginning of a line
-       insertRow(E.cy, "", 0); //insert a new blank row
-   } else {
-       erow *row = &E.row[E.cy];
-       insertRow(E.cy + 1, &row->chars[E.cx],
-                 row->size - E.cx); //pass the characters on current row which are right of the cursor
-       row = &E.row[E.cy]; //reassign the row pointer
-       row->size = E.cx; //cut off current rows content by setting size to the position of the cursor
-       row->chars[row->size] = '\0'; //signifies end of line
-       updateRow(row);
-   }
-   E.cy++;
-   E.cx = 0; //move cursor to beginning of row
+erow *rowAt(int at) {
+    return rowIterAt(&E.rowcache, at);
 }
 
-/*** append buffer ***/
+/**
+ * Returns the byte offset in the file of the start of the row at index at, at == E.numrows gives the size.
+ * @param at
+ * @return offset
+ */
+long long rowOffset(int at) {
+    rowBlock *b = E.rowroot;
+    int base = 0;
+    long long off = 0;
+    while (b) {
+        int l = blockRows(b->left);
+        if (at < base + l) {
+            b = b->left;
+        } else if (at < base + l + b->count) {
+            off += blockBytes(b->left);
+            for (int i = 0; i < at - base - l; i++) off += b->rows[i].size + 1;
+            return off;
+        } else {
+            base += l + b->count;
+            off += blockBytes(b->left) + b->bytes;
+            b = b->right;
+        }
+    }
+    return off;
+}
+
+/**
+ * Returns the index of the row which holds the byte offset off of the file, E.numrows if off is past the end.
+ * @param off
+ * @param col column of off in the row
+ * @return index of the row
+ */
+int rowAtOffset(long long off, int *col) {
+    rowBlock *b = E.rowroot;
+    int base = 0;
+    *col = 0;
+    while (b) {
+        long long l = blockBytes(b->left);
+        if (off < l) {
+            b = b->left;
+        } else if (off < l + b->bytes) {
+            off -= l;
+            base += blockRows(b->left);
+            int i = 0;
+            while (off > b->rows[i].size) off -= b->rows[i++].size + 1;
+            *col = off;
+            return base + i;
+        } else {
+            off -= l + b->bytes;
+            base += blockRows(b->left) + b->count;
+            b = b->right;
+        }
+    }
+    return E.numrows;
+}
+
+/**
+ * This function tells the row store that the row at index at got delta bytes longer.
+ * @param at
+ * @param delta
+ */
+void rowStoreResize(int at, int delta) {
+    if (at < E.hlvalid) E.hlvalid = at; //the highlighting from this row on has to be checked again
+    int start = 0;
+    rowBlock *b = blockFind(at, &start);
+    if (b) blockAdjust(b, 0, delta);
+}
+
+/**
+ * This function makes room for a new row of size bytes at index at and returns it. The size is set,
+ * the rest of the row contents is left to the caller.
+ * @param at
+ * @param size
+ * @return the row
+ */
+erow *rowStoreInsert(int at, int size) {
+    rowBlock *b;
+    int start = 0;
+    if (at < E.hlvalid) E.hlvalid = at;
+    E.rowcache.block = NULL;
+    if (E.rowroot == NULL) {
+        b = blockInsertAfter(NULL);
+    } else if (at == E.numrows) {
+        b = blockFind(at - 1, &start); //appending to the last block
+    } else {
+        b = blockFind(at, &start);
+    }
+    int pos = at - start;
+    if (pos == TECS_ROW_BLOCK) { //appending behind a full block starts a new one, so loaded files fill their blocks
+        b = blockInsertAfter(b);
+        pos = 0;
+    } else if (b->count == TECS_ROW_BLOCK) { //block is full, move its upper half into a new block
+        rowBlock *n = blockInsertAfter(b);
+        int half = TECS_ROW_BLOCK / 2;
+        memcpy(n->rows, &b->rows[half], sizeof(erow) * (TECS_ROW_BLOCK - half));
+        n->count = TECS_ROW_BLOCK - half;
+        b->count = half;
+        long long moved = 0;
+        for (int i = 0; i < n->count; i++) moved += n->rows[i].size + 1;
+        blockAdjust(n, n->count, moved);
+        blockAdjust(b, -n->count, -moved);
+        if (pos > half) {
+            b = n;
+            pos -= half;
+        }
+    }
+    memmove(&b->rows[pos + 1], &b->rows[pos], sizeof(erow) * (b->count - pos));
+    b->count++;
+    blockAdjust(b, 1, size + 1);
+    E.numrows++;
+    b->rows[pos].size = size;
+    return &b->rows[pos];
+}
+
+/**
+ * This function removes the row at index at from the store. The memory owned by the row must already be freed.
+ * Blocks which become sparse are merged with their successor so the tree does not fill up with tiny blocks.
+ * @param at
+ */
+void rowStoreDelete(int at) {
+    int start = 0;
+    if (at < E.hlvalid) E.hlvalid = at;
+    rowBlock *b = blockFind(at, &start);
+    E.rowcache.block = NULL;
+    int pos = at - start;
+    int size = b->rows[pos].size;
+    memmove(&b->rows[pos], &b->rows[pos + 1], sizeof(erow) * (b->count - pos - 1));
+    b->count--;
+    blockAdjust(b, -1, -(size + 1));
+    E.numrows--;
+    if (b->count == 0) {
+        blockRemove(b);
+        return;
+    }
+    rowBlock *next = blockNext(b);
+    if (next && b->count + next->count <= TECS_ROW_BLOCK / 2) {
+        memcpy(&b->rows[b->count], next->rows, sizeof(erow) * next->count);
+        long long moved = next->bytes;
+        blockAdjust(b, next->count, moved);
+        b->count += next->count;
+        blockAdjust(next, -next->count, -moved);
+        next->count = 0;
+        blockRemove(next);
+    }
+}
+
+/*** text arena ***/
+/**
+ * Returns the size class of a slot size.
+ */
+int textClass(int cap) {
+    int c = 0;
+    while ((TECS_TEXT_MIN << c) < cap) c++;
+    return c;
+}
+
+/**
+ * Returns the capacity an allocation of need bytes gets: the next power of two for arena slots, which
+ * leaves room to type into a row, or a multiple of TECS_TEXT_MAX for malloc()ed text.
+ */
+int textCapacity(int need) {
+    if (need > TECS_TEXT_MAX) return (need + TECS_TEXT_MAX - 1) / TECS_TEXT_MAX * TECS_TEXT_MAX;
+    return TECS_TEXT_MIN << textClass(need);
+}
+
+/**
+ * This function allocates at least need bytes of row text.
+ * @param need
+ * @param cap set to the size of the allocation, which has to be passed to textFree()
+ * @return the memory
+ */
+char *textAlloc(int need, int *cap) {
+    struct textHeap *h = &E.text;
+    *cap = textCapacity(need);
+    if (*cap > TECS_TEXT_MAX) {
+        char *p = malloc(*cap);
+        if (p == NULL) quit("malloc");
+        h->largebytes += *cap;
+        return p;
+    }
+    int c = textClass(*cap);
+    h->usedbytes += *cap;
+    if (h->free[c]) { //reuse a freed slot
+        void *slot = h->free[c];
+        memcpy(&h->free[c], slot, sizeof(void *));
+        return slot;
+    }
+    if (h->end - h->cur < *cap) { //arena is used up, start a new one
+        textArena *a = malloc(sizeof(textArena) + TECS_TEXT_ARENA);
+        if (a == NULL) quit("malloc");
+        a->next = h->arenas;
+        h->arenas = a;
+        h->cur = a->data;
+        h->end = a->data + TECS_TEXT_ARENA;
+        h->arenabytes += TECS_TEXT_ARENA;
+    }
+    char *p = h->cur;
+    h->cur += *cap;
+    return p;
+}
+
+/**
+ * This function frees row text allocated by textAlloc().
+ * @param p may be NULL
+ * @param cap the capacity textAlloc() returned
+ */
+void textFree(char *p, int cap) {
+    if (p == NULL) return;
+    if (cap > TECS_TEXT_MAX) {
+        free(p);
+        E.text.largebytes -= cap;
+        return;
+    }
+    int c = textClass(cap);
+    memcpy(p, &E.text.free[c], sizeof(void *));
+    E.text.free[c] = p;
+    E.text.usedbytes -= cap;
+}
+
+/**
+ * This function makes sure row text can hold need bytes. The old contents are kept.
+ * @param p
+ * @param cap capacity of p, updated
+ * @param need
+ * @return the memory, p itself if it is large enough
+ */
+char *textRealloc(char *p, int *cap, int need) {
+    if (need <= *cap) return p;
+    if (*cap > TECS_TEXT_MAX) {
+        E.text.largebytes -= *cap;
+        *cap = textCapacity(need);
+        E.text.largebytes += *cap;
+        p = realloc(p, *cap);
+        if (p == NULL) quit("realloc");
+        return p;
+    }
+    int newcap;
+    char *n = textAlloc(need, &newcap);
+    if (p) memcpy(n, p, *cap);
+    textFree(p, *cap);
+    *cap = newcap;
+    return n;
+}
+
+/**
+ * This function moves text of a row which lives in the old arenas into the current ones.
+ */
+char *textMove(char *p, int cap) {
+    if (p == NULL || cap > TECS_TEXT_MAX) return p;
+    int newcap;
+    char *n = textAlloc(cap, &newcap);
+    memcpy(n, p, cap);
+    return n;
+}
+
+/**
+ * This function compacts the text arenas. After a lot of editing the arenas are full of free slots
+ * which can only be reused for text of the same size class. The text of all rows is copied into
+ * new arenas in file order and the old arenas are freed as a whole.
+ */
+void textCompact() {
+    struct textHeap old = E.text;
+    memset(&E.text, 0, sizeof(E.text));
+    E.text.largebytes = old.largebytes; //malloc()ed text stays where it is
+    int start;
+    for (rowBlock *b = E.numrows ? blockFind(0, &start) : NULL; b; b = blockNext(b)) {
+        for (int j = 0; j < b->count; j++) {
+            erow *row = &b->rows[j];
+            if (!(row->flags & ROW_MAPPED)) row->chars = textMove(row->chars, row->ccap);
+            if (row->flags & ROW_ALIAS) row->render = row->chars;
+            else row->render = textMove(row->render, row->rcap);
+        }
+    }
+    while (old.arenas) {
+        textArena *next = old.arenas->next;
+        free(old.arenas);
+        old.arenas = next;
+    }
+}
+
+/**
+ * This function compacts the text arenas when less than a quarter of them is in use. Nothing may hold
+ * a pointer to row text while it runs.
+ */
+void textMaybeCompact() {
+    if (E.text.arenabytes < 4 * TECS_TEXT_ARENA || E.text.usedbytes > E.text.arenabytes / 4) return;
+    if (E.search.running) return; //the search thread reads the rows
+    textCompact();
+}
+
+/*** trace ***/
+static _Thread_local int traceTid; //id of the calling thread in the trace, 0 until it records a span
+
+/**
+ * This function turns tracing on. The spans are written to path when the program exits.
+ * @param path
+ */
+void traceStart(char *path) {
+    E.trace.ring = calloc(TECS_TRACE_EVENTS, sizeof(traceEvent));
+    if (E.trace.ring == NULL) quit("calloc");
+    E.trace.path = path;
+    E.trace.epoch = hudNow();
+    E.trace.on = 1;
+    atexit(traceDump);
+}
+
+/**
+ * Returns the start of a span, 0 while tracing is off.
+ */
+long long traceBegin() {
+    return E.trace.on ? hudNow() : 0;
+}
+
+/**
+ * This function records the span name from start until now. Can be called from any thread.
+ * @param name a string literal
+ * @param start the value traceBegin() returned
+ */
+void traceEnd(const char *name, long long start) {
+    if (start == 0) return;
+    long long now = hudNow();
+    if (traceTid == 0) traceTid = atomic_fetch_add(&E.trace.threads, 1) + 1;
+    unsigned long long n = atomic_fetch_add_explicit(&E.trace.next, 1, memory_order_relaxed);
+    traceEvent *e = &E.trace.ring[n % TECS_TRACE_EVENTS];
+    atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+    e->name = name;
+    e->start = start;
+    e->dur = now - start;
+    e->tid = traceTid;
+    atomic_store_explicit(&e->seq, n + 1, memory_order_release);
+}
+
+/**
+ * This function writes the recorded spans as Chrome trace event JSON, which chrome://tracing and
+ * Perfetto open. Registered with atexit() by traceStart().
+ */
+void traceDump() {
+    FILE *fp = fopen(E.trace.path, "w");
+    if (fp == NULL) return;
+    unsigned long long end = atomic_load(&E.trace.next);
+    unsigned long long n = end > TECS_TRACE_EVENTS ? end - TECS_TRACE_EVENTS : 0;
+    const char *sep = "";
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (; n < end; n++) {
+        traceEvent *e = &E.trace.ring[n % TECS_TRACE_EVENTS];
+        if (atomic_load_explicit(&e->seq, memory_order_acquire) != n + 1) continue; //overwritten or unfinished
+        fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", sep,
+                e->name, (int) getpid(), e->tid, (e->start - E.trace.epoch) / 1000.0, e->dur / 1000.0);
+        sep = ",";
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+}
+
+/*** unicode ***/
+/**
+ * Display widths of the characters which aren't one column wide: combining marks and other zero width
+ * characters, and the East Asian wide and fullwidth characters and emojis which take two columns.
+ * Sorted, so the width of a character is found with a binary search.
+ */
+static const struct {
+    unsigned first, last;
+    unsigned char width;
+} widthTable[] = {
+        {0x0300, 0x036F, 0}, {0x0483, 0x0489, 0}, {0x0591, 0x05BD, 0}, {0x05BF, 0x05C7, 0},
+        {0x0610, 0x061A, 0}, {0x064B, 0x065F, 0}, {0x0670, 0x0670, 0}, {0x06D6, 0x06ED, 0},
+        {0x0900, 0x0903, 0}, {0x093A, 0x094F, 0}, {0x0951, 0x0957, 0}, {0x0E31, 0x0E31, 0},
+        {0x0E34, 0x0E3A, 0}, {0x0E47, 0x0E4E, 0}, {0x1100, 0x115F, 2}, {0x1AB0, 0x1AFF, 0},
+        {0x1DC0, 0x1DFF, 0}, {0x200B, 0x200F, 0}, {0x202A, 0x202E, 0}, {0x2060, 0x2064, 0},
+        {0x20D0, 0x20FF, 0}, {0x231A, 0x231B, 2}, {0x2329, 0x232A, 2}, {0x23E9, 0x23EC, 2},
+        {0x23F0, 0x23F0, 2}, {0x23F3, 0x23F3, 2}, {0x25FD, 0x25FE, 2}, {0x2614, 0x2615, 2},
+        {0x2648, 0x2653, 2}, {0x267F, 0x267F, 2}, {0x2693, 0x2693, 2}, {0x26A1, 0x26A1, 2},
+        {0x26AA, 0x26AB, 2}, {0x26BD, 0x26BE, 2}, {0x26C4, 0x26C5, 2}, {0x26CE, 0x26CE, 2},
+        {0x26D4, 0x26D4, 2}, {0x26EA, 0x26EA, 2}, {0x26F2, 0x26F3, 2}, {0x26F5, 0x26F5, 2},
+        {0x26FA, 0x26FA, 2}, {0x26FD, 0x26FD, 2}, {0x2705, 0x2705, 2}, {0x270A, 0x270B, 2},
+        {0x2728, 0x2728, 2}, {0x274C, 0x274C, 2}, {0x274E, 0x274E, 2}, {0x2753, 0x2755, 2},
+        {0x2757, 0x2757, 2}, {0x2795, 0x2797, 2}, {0x27B0, 0x27B0, 2}, {0x27BF, 0x27BF, 2},
+        {0x2B1B, 0x2B1C, 2}, {0x2B50, 0x2B50, 2}, {0x2B55, 0x2B55, 2}, {0x2E80, 0x303E, 2},
+        {0x3041, 0x3096, 2}, {0x3099, 0x309A, 0}, {0x309B, 0x33FF, 2}, {0x3400, 0x4DBF, 2},
+        {0x4E00, 0x9FFF, 2}, {0xA000, 0xA4CF, 2}, {0xA960, 0xA97F, 2}, {0xAC00, 0xD7A3, 2},
+        {0xF900, 0xFAFF, 2}, {0xFE00, 0xFE0F, 0}, {0xFE10, 0xFE19, 2}, {0xFE20, 0xFE2F, 0},
+        {0xFE30, 0xFE6F, 2}, {0xFEFF, 0xFEFF, 0}, {0xFF00, 0xFF60, 2}, {0xFFE0, 0xFFE6, 2},
+        {0x16FE0, 0x16FE4, 2}, {0x17000, 0x18CFF, 2}, {0x1B000, 0x1B2FF, 2}, {0x1F004, 0x1F004, 2},
+        {0x1F0CF, 0x1F0CF, 2}, {0x1F18E, 0x1F18E, 2}, {0x1F191, 0x1F19A, 2}, {0x1F200, 0x1F202, 2},
+        {0x1F210, 0x1F23B, 2}, {0x1F240, 0x1F248, 2}, {0x1F250, 0x1F251, 2}, {0x1F260, 0x1F265, 2},
+        {0x1F300, 0x1F320, 2}, {0x1F32D, 0x1F335, 2}, {0x1F337, 0x1F37C, 2}, {0x1F37E, 0x1F393, 2},
+        {0x1F3A0, 0x1F3CA, 2}, {0x1F3CF, 0x1F3D3, 2}, {0x1F3E0, 0x1F3F0, 2}, {0x1F3F4, 0x1F3F4, 2},
+        {0x1F3F8, 0x1F43E, 2}, {0x1F440, 0x1F440, 2}, {0x1F442, 0x1F4FC, 2}, {0x1F4FF, 0x1F53D, 2},
+        {0x1F54B, 0x1F54E, 2}, {0x1F550, 0x1F567, 2}, {0x1F57A, 0x1F57A, 2}, {0x1F595, 0x1F596, 2},
+        {0x1F5A4, 0x1F5A4, 2}, {0x1F5FB, 0x1F64F, 2}, {0x1F680, 0x1F6C5, 2}, {0x1F6CC, 0x1F6CC, 2},
+        {0x1F6D0, 0x1F6D2, 2}, {0x1F6D5, 0x1F6D7, 2}, {0x1F6EB, 0x1F6EC, 2}, {0x1F6F4, 0x1F6FC, 2},
+        {0x1F7E0, 0x1F7EB, 2}, {0x1F90C, 0x1F93A, 2}, {0x1F93C, 0x1F945, 2}, {0x1F947, 0x1F9FF, 2},
+        {0x1FA70, 0x1FAFF, 2}, {0x20000, 0x2FFFD, 2}, {0x30000, 0x3FFFD, 2}, {0xE0001, 0xE007F, 0},
+        {0xE0100, 0xE01EF, 0},
+};
+
+/**
+ * Returns the number of columns the character cp takes on the terminal.
+ */
+int charWidth(unsigned cp) {
+    if (cp < 0x300) return 1;
+    int lo = 0, hi = sizeof(widthTable) / sizeof(widthTable[0]) - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp < widthTable[mid].first) hi = mid - 1;
+        else if (cp > widthTable[mid].last) lo = mid + 1;
+        else return widthTable[mid].width;
+    }
+    return 1;
+}
+
+/**
+ * This function decodes the UTF-8 character at s. A byte which doesn't start a valid sequence is a
+ * character of its own, one column wide.
+ * @param s
+ * @param len bytes available at s, at least 1
+ * @param width gets the number of columns of the character
+ * @return number of bytes of the character
+ */
+int utf8Decode(const char *s, int len, int *width) {
+    const unsigned char *u = (const unsigned char *) s;
+    *width = 1;
+    if (u[0] < 0x80) return 1;
+    int n = u[0] >= 0xF0 && u[0] < 0xF5 ? 4 : u[0] >= 0xE0 && u[0] < 0xF0 ? 3 : u[0] >= 0xC2 && u[0] < 0xE0 ? 2 : 0;
+    if (n == 0 || n > len) return 1;
+    unsigned cp = u[0] & (0x7F >> n);
+    for (int i = 1; i < n; i++) {
+        if ((u[i] & 0xC0) != 0x80) return 1;
+        cp = cp << 6 | (u[i] & 0x3F);
+    }
+    if ((n == 3 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))) || (n == 4 && (cp < 0x10000 || cp > 0x10FFFF)))
+        return 1; //overlong or a surrogate
+    *width = charWidth(cp);
+    return n;
+}
+
+/**
+ * Returns the index of the start of the character which contains the byte at index at of the len bytes at s.
+ */
+int utf8Start(const char *s, int len, int at) {
+    int start = at;
+    while (start > 0 && at - start < 3 && ((unsigned char) s[start] & 0xC0) == 0x80) start--;
+    int width;
+    return start + utf8Decode(&s[start], len - start, &width) > at ? start : at; //else a stray continuation byte
+}
+
+/**
+ * Returns the first tab or non-ASCII byte of the n bytes at s, NULL if there is none. Eight bytes are
+ * tested at once, so the column index of a long ASCII row is built about as fast as memchr() finds tabs.
+ */
+const char *columnStop(const char *s, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, 8);
+        uint64_t t = w ^ 0x0909090909090909ULL; //tabs become zero bytes
+        if ((((t - 0x0101010101010101ULL) & ~t) | w) & 0x8080808080808080ULL) break;
+    }
+    for (; i < n; i++)
+        if (s[i] == '\t' || (unsigned char) s[i] >= 0x80) return s + i;
+    return NULL;
+}
+
+/**
+ * Returns the number of leading bytes of s which fit into cols columns, without cutting a character.
+ * @param s
+ * @param len
+ * @param cols
+ * @param used gets the columns these bytes take, may be NULL
+ */
+int utf8Fit(const char *s, int len, int cols, int *used) {
+    int i = 0, c = 0;
+    while (i < len) {
+        int width;
+        int n = utf8Decode(&s[i], len - i, &width);
+        if (c + width > cols) break;
+        c += width;
+        i += n;
+    }
+    if (used) *used = c;
+    return i;
+}
+
+/*** row operations ***/
+/**
+ * Returns the render column of the chars index scanned of a column index.
+ */
+int colIndexScannedRx(colIndex *ci) {
+    if (ci->n == 0) return ci->scanned;
+    tabStop *last = &ci->stops[ci->n - 1];
+    return last->rx + (ci->scanned - last->cx - 1);
+}
+
+/**
+ * This function extends the column index of a long row by looking for tabs and non-ASCII characters in
+ * the chars up to limit.
+ * The index is built lazily, only as far as column conversions have needed it so far.
+ * @param row
+ * @param limit chars index up to which the index gets complete
+ */
+void colIndexScan(erow *row, int limit) {
+    if (row->colidx == NULL) {
+        row->colidx = malloc(sizeof(colIndex) + 16 * sizeof(tabStop));
+        if (row->colidx == NULL) quit("malloc");
+        row->colidx->n = 0;
+        row->colidx->cap = 16;
+        row->colidx->scanned = 0;
+    }
+    colIndex *ci = row->colidx;
+    if (limit > row->size) limit = row->size;
+    while (ci->scanned < limit) {
+        const char *stop = columnStop(&row->chars[ci->scanned], limit - ci->scanned);
+        if (stop == NULL) {
+            ci->scanned = limit;
+            break;
+        }
+        int cx = stop - row->chars;
+        ci->scanned = cx;
+        int rx = colIndexScannedRx(ci);
+        int n = 1, width;
+        if (*stop == '\t') width = TECS_TAB_STOP - rx % TECS_TAB_STOP;
+        else n = utf8Decode(stop, row->size - cx, &width);
+        if (ci->n == ci->cap) {
+            ci->cap *= 2;
+            ci = row->colidx = realloc(ci, sizeof(colIndex) + ci->cap * sizeof(tabStop));
+            if (ci == NULL) quit("realloc");
+        }
+        ci->stops[ci->n].cx = cx + n - 1;
+        ci->stops[ci->n].rx = rx + width;
+        ci->n++;
+        ci->scanned = cx + n;
+    }
+}
+
+/**
+ * This function drops the part of the column index from chars index at onwards, because the chars
+ * there have changed. It gets rebuilt from there the next time it is needed.
+ * @param row
+ * @param at
+ */
+void colIndexInvalidate(erow *row, int at) {
+    colIndex *ci = row->colidx;
+    if (ci == NULL || ci->scanned <= at) return;
+    int lo = 0, hi = ci->n;
+    while (lo < hi) { //first stop at or behind at
+        int mid = (lo + hi) / 2;
+        if (ci->stops[mid].cx < at) lo = mid + 1;
+        else hi = mid;
+    }
+    ci->n = lo;
+    ci->scanned = at;
+}
+
+/**
+ * This function converts chars index into a render index
+ * Long rows use their column index, a binary search over the tabs in front of cx.
+ * @param row
+ * @param cx
+ * @return
+ */
+int cXToRx(erow *row, int cx) {
+    if (row->size > TECS_LONG_LINE) {
+        colIndexScan(row, cx);
+        colIndex *ci = row->colidx;
+        int lo = 0, hi = ci->n;
+        while (lo < hi) { //number of stops in front of cx
+            int mid = (lo + hi) / 2;
+            if (ci->stops[mid].cx < cx) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == 0) return cx;
+        return ci->stops[lo - 1].rx + (cx - ci->stops[lo - 1].cx - 1);
+    }
+    int rx = 0;
+    int j;
+    if (row->render == NULL || (row->flags & ROW_UTF8)) {
+        for (j = 0; j < cx;) {
+            int width = TECS_TAB_STOP - rx % TECS_TAB_STOP;
+            if (row->chars[j] == '\t') j++;
+            else j += utf8Decode(&row->chars[j], row->size - j, &width);
+            rx += width;
+        }
+        return rx;
+    }
+    for (j = 0; j < cx; j++) { //loop through all the characters left of cx
+        if (row->chars[j] == '\t')
+            rx += (TECS_TAB_STOP - 1) - (rx %
+                                         TECS_TAB_STOP); //subtract the amount of columns we are right of last tab stop from amount of columns to the left of next tab stop.
+        rx++; // this gets us to the next tab stop
+    }
+    return rx;
+}
+
+/**
+ * This function converts render index into a char index
+ * Long rows use their column index, a binary search over the columns where the tabs and wide characters end.
+ * @param row
+ * @param rx
+ * @return
+ */
+int rXToCx(erow *row, int rx) {
+    if (row->size > TECS_LONG_LINE) {
+        colIndexScan(row, 0);
+        while (row->colidx->scanned < row->size && colIndexScannedRx(row->colidx) <= rx) //index must reach column rx
+            colIndexScan(row, row->colidx->scanned + (rx - colIndexScannedRx(row->colidx)) + 1);
+        colIndex *ci = row->colidx;
+        int lo = 0, hi = ci->n;
+        while (lo < hi) { //number of stops which end at or left of rx
+            int mid = (lo + hi) / 2;
+            if (ci->stops[mid].rx <= rx) lo = mid + 1;
+            else hi = mid;
+        }
+        int cx = lo == 0 ? rx : ci->stops[lo - 1].cx + 1 + (rx - ci->stops[lo - 1].rx);
+        if (lo < ci->n && cx > ci->stops[lo].cx) //rx is inside the next tab or character
+            cx = utf8Start(row->chars, row->size, ci->stops[lo].cx);
+        return cx < row->size ? cx : row->size;
+    }
+    int cur_rx = 0;
+    int cx;
+    if (row->render == NULL || (row->flags & ROW_UTF8)) {
+        for (cx = 0; cx < row->size;) {
+            int n = 1, width = TECS_TAB_STOP - cur_rx % TECS_TAB_STOP;
+            if (row->chars[cx] != '\t') n = utf8Decode(&row->chars[cx], row->size - cx, &width);
+            cur_rx += width;
+            if (cur_rx > rx) return cx;
+            cx += n;
+        }
+        return cx;
+    }
+    for (cx = 0; cx < row->size; cx++) { //loop through the chars
+        if (row->chars[cx] == '\t')
+            cur_rx += (TECS_TAB_STOP - 1) - (cur_rx % TECS_TAB_STOP); //calculate current cx value
+        cur_rx++;
+        if (cur_rx > rx) return cx; //if current rx hits given rx value return cx
+    }
+    return cx; //if rx is out of range
+}
+
+/**
+ * This function makes sure the separate render buffer of a row can hold need bytes.
+ * The buffer grows geometrically, so typing into a row doesn't reallocate it on every key.
+ * @param row
+ * @param need
+ */
+void rowRenderReserve(erow *row, int need) {
+    if (row->flags & ROW_ALIAS) {
+        row->render = NULL;
+        row->rcap = 0;
+        row->flags &= ~ROW_ALIAS;
+    }
+    row->render = textRealloc(row->render, &row->rcap, need);
+}
+
+/**
+ * This function uses the chars string of a row to fill the contents of the rendered string.
+ * A row without tabs renders to exactly its chars, so render just points to chars (ROW_ALIAS).
+ * Rows with non-ASCII characters are flagged ROW_UTF8, all others take the fast paths of one byte per column.
+ * @param row
+ */
+void updateRow(erow *row) {
+    int tabs = 0;
+    unsigned char high = 0;
+    int j;
+    const char *stop = columnStop(row->chars, row->size); //most rows are plain ASCII and end here
+    for (j = stop ? stop - row->chars : row->size; j < row->size; j++) { //we loop through the rest of the chars
+        if (row->chars[j] == '\t') tabs++;
+        high |= row->chars[j];
+    }
+    row->tabs = tabs;
+    if (high & 0x80) row->flags |= ROW_UTF8;
+    else row->flags &= ~ROW_UTF8;
+    if (tabs == 0) {
+        if (!(row->flags & ROW_ALIAS)) textFree(row->render, row->rcap);
+        row->render = row->chars;
+        row->rcap = 0;
+        row->rsize = row->size;
+        row->flags |= ROW_ALIAS;
+        return;
+    }
+    rowRenderReserve(row, row->size + tabs * (TECS_TAB_STOP - 1) + 1); //allocate memory for render(count of tabs)
+    int idx = 0;
+    int rx = 0; //the column, which is behind idx for wide characters and ahead of it for combining ones
+    for (j = 0; j < row->size; j++) {
+        if (row->chars[j] == '\t') { //checks whether the current character is a tab
+            row->render[idx++] = ' '; // if it is, we append one space
+            rx++;
+            while (rx % TECS_TAB_STOP != 0) {
+                row->render[idx++] = ' '; //append spaces until we get a tab stop, which is a column divisible by 8
+                rx++;
+            }
+        } else if ((unsigned char) row->chars[j] >= 0x80) {
+            int width;
+            int n = utf8Decode(&row->chars[j], row->size - j, &width);
+            memcpy(&row->render[idx], &row->chars[j], n);
+            idx += n;
+            rx += width;
+            j += n - 1;
+        } else {
+            row->render[idx++] = row->chars[j];
+            rx++;
+        }
+    }
+    row->render[idx] = '\0';
+    row->rsize = idx; //contains the number of characters of row -> render
+}
+
+/**
+ * This function brings the render of a row up to date after its chars changed. The characters in front of
+ * at are unchanged, inserted characters now start at at and the deleted characters were removed at at.
+ * Render columns are only rewritten from at up to the point where the old and the new render line up
+ * again, which is after the next tab in most cases. Rows which are not rendered stay that way until
+ * they are drawn.
+ * @param row
+ * @param at index of the first changed character
+ * @param inserted number of characters inserted at at
+ * @param deleted the characters which were removed at at, NULL if none
+ * @param ndeleted number of removed characters
+ */
+void rowRenderUpdate(erow *row, int at, int inserted, const char *deleted, int ndeleted) {
+    colIndexInvalidate(row, at);
+    row->flags &= ~ROW_HL; //highlighted again when it gets drawn
+    if (row->render && row->size > TECS_LONG_LINE && !(row->flags & ROW_ALIAS)) { //long rows are drawn from chars
+        textFree(row->render, row->rcap);
+        row->render = NULL;
+        row->rcap = 0;
+    }
+    if (row->render == NULL) return; //not rendered yet
+    int j;
+    int high = row->flags & ROW_UTF8;
+    for (j = at; j < at + inserted && !high; j++) high = (unsigned char) row->chars[j] >= 0x80;
+    if (high) { //bytes aren't columns, the row is rendered again as a whole
+        updateRow(row);
+        return;
+    }
+    int tabs = row->tabs;
+    for (j = at; j < at + inserted; j++)
+        if (row->chars[j] == '\t') tabs++;
+    for (j = 0; j < ndeleted; j++)
+        if (deleted[j] == '\t') tabs--;
+    row->tabs = tabs;
+    if (tabs == 0) { //render is the chars themselves
+        if (!(row->flags & ROW_ALIAS)) textFree(row->render, row->rcap);
+        row->render = row->chars;
+        row->rcap = 0;
+        row->rsize = row->size;
+        row->flags |= ROW_ALIAS;
+        return;
+    }
+    if (row->flags & ROW_ALIAS) { //the first tab, the row needs its own render now
+        updateRow(row);
+        return;
+    }
+    rowRenderReserve(row, row->size + tabs * (TECS_TAB_STOP - 1) + 1);
+    int rx = cXToRx(row, at);
+    int oldrx = rx; //column where the old character, which is now at index at + inserted, was drawn
+    for (j = 0; j < ndeleted; j++)
+        oldrx += deleted[j] == '\t' ? TECS_TAB_STOP - oldrx % TECS_TAB_STOP : 1;
+    for (j = at; j < row->size; j++) {
+        int old = j >= at + inserted;
+        if (old && rx == oldrx) return; //the rest of the render is unchanged
+        if (row->chars[j] == '\t') {
+            do row->render[rx++] = ' '; while (rx % TECS_TAB_STOP != 0);
+        } else {
+            row->render[rx++] = row->chars[j];
+        }
+        if (old) oldrx += row->chars[j] == '\t' ? TECS_TAB_STOP - oldrx % TECS_TAB_STOP : 1;
+    }
+    row->render[rx] = '\0';
+    row->rsize = rx;
+}
+
+/**
+ * This function allocates space for a new erow in the row store, and then copies the given string
+ * into it. It inserts a row at the index specified by the new argument.
+ * @param at
+ * @param s
+ * @param len
+ */
+void insertRow(int at, char *s, size_t len) {
+    if (at < 0 || at > E.numrows) return; //validate at
+    long long t = traceBegin();
+    erow *row = rowStoreInsert(at, len); //make room at the specified index for the new row
+    if (E.load.active && at <= E.load.at) E.load.at++; //rows still being loaded come after it
+
+    row->size = len;
+    row->chars = textAlloc(len + 1, &row->ccap);
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+    undoRecordRows(UNDO_INSERT_ROWS, at, row->chars, len);
+    autosaveRecord(UNDO_INSERT_ROWS, at, 0, row->chars, len);
+
+    row->rsize = 0;
+    row->rcap = 0;
+    row->flags = 0;
+    row->render = NULL; //rendered when it gets drawn
+    row->hl = NULL;
+    row->colidx = NULL;
+
+    E.dirty++;
+    traceEnd("insertRow", t);
+}
+
+/**
+ * This function inserts a row which is a view into the memory mapped file. Nothing is copied,
+ * the row is rendered when it gets drawn and copied by rowMaterialize() when it gets edited.
+ * @param at
+ * @param s start of the line inside E.map
+ * @param len
+ */
+void insertMappedRow(int at, char *s, size_t len) {
+    erow *row = rowStoreInsert(at, len);
+    row->size = len;
+    row->rsize = 0;
+    row->rcap = 0;
+    row->flags = ROW_MAPPED;
+    row->ccap = 0;
+    row->chars = s;
+    row->render = NULL;
+    row->hl = NULL;
+    row->colidx = NULL;
+}
+
+/**
+ * This function gives a mapped row its own copy of the characters, so that it can be edited.
+ * @param row
+ */
+void rowMaterialize(erow *row) {
+    if (!(row->flags & ROW_MAPPED)) return;
+    char *chars = textAlloc(row->size + 1, &row->ccap);
+    memcpy(chars, row->chars, row->size);
+    chars[row->size] = '\0';
+    row->chars = chars;
+    if (row->flags & ROW_ALIAS) row->render = chars;
+    row->flags &= ~ROW_MAPPED;
+}
+
+/**
+ * This function appends a row which already is in the file on disk, e.g. a line a followed file grew by.
+ * Unlike insertRow() this is no change: it is not recorded and doesn't make the file dirty.
+ * @param s
+ * @param len
+ */
+void appendFileRow(const char *s, size_t len) {
+    erow *row = rowStoreInsert(E.numrows, len);
+    row->size = len;
+    row->chars = textAlloc(len + 1, &row->ccap);
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+    row->rsize = 0;
+    row->rcap = 0;
+    row->flags = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->colidx = NULL;
+}
+
+/**
+ * This function appends text the file on disk grew by to the row at, which had no newline yet.
+ * Like appendFileRow() it is no change.
+ * @param at
+ * @param s
+ * @param len
+ */
+void extendFileRow(int at, const char *s, int len) {
+    erow *row = rowAt(at);
+    rowMaterialize(row);
+    rowStoreResize(at, len);
+    row->chars = textRealloc(row->chars, &row->ccap, row->size + len + 1);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    rowRenderUpdate(row, row->size - len, len, NULL, 0);
+}
+
+/**
+ * This function makes sure the render field of a row is filled before it gets drawn.
+ * @param row
+ * @return the row
+ */
+erow *rowRender(erow *row) {
+    if (row->render == NULL) updateRow(row);
+    return row;
+}
+
+/**
+ * This function frees the memory owned by row.
+ * @param row
+ */
+void editorFreeRow(erow *row) {
+    if (!(row->flags & ROW_ALIAS)) textFree(row->render, row->rcap);
+    free(row->hl);
+    free(row->colidx);
+    if (!(row->flags & ROW_MAPPED)) textFree(row->chars, row->ccap);
+}
+
+/**
+ * This function deletes the row.
+ * @param at
+ */
+void deleteRow(int at) {
+    if (at < 0 || at >= E.numrows) return; //validate the at index
+    long long t = traceBegin();
+    erow *row = rowAt(at);
+    undoRecordRows(UNDO_DELETE_ROWS, at, row->chars, row->size);
+    autosaveRecord(UNDO_DELETE_ROWS, at, 0, NULL, 0);
+    editorFreeRow(row); //free memory owned by the row
+    rowStoreDelete(at); //remove the row struct from the row store
+    if (E.load.active && at < E.load.at) E.load.at--;
+    E.dirty++;
+    traceEnd("deleteRow", t);
+}
+
+/**
+ * This function inserts a string into row y at index at.
+ * @param y
+ * @param at
+ * @param s
+ * @param len
+ */
+void rowInsertString(int y, int at, const char *s, int len) {
+    long long t = traceBegin();
+    erow *row = rowAt(y);
+    if (at < 0 || at > row->size) at = row->size;
+    rowMaterialize(row);
+    undoRecordText(UNDO_INSERT, y, at, s, len);
+    autosaveRecord(UNDO_INSERT, y, at, s, len);
+    row->chars = textRealloc(row->chars, &row->ccap, row->size + len + 1); //make room for the string
+    memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1); //memmove makes room for the new characters
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+    rowStoreResize(y, len);
+    rowRenderUpdate(row, at, len, NULL, 0); //Update fields with the new row content
+    E.dirty++;
+    traceEnd("rowInsertString", t);
+}
+
+/**
+ * This function deletes len characters of row y from index at on.
+ * @param y
+ * @param at
+ * @param len
+ */
+void rowDeleteString(int y, int at, int len) {
+    erow *row = rowAt(y);
+    if (at < 0 || len <= 0 || at + len > row->size) return;
+    long long t = traceBegin();
+    rowMaterialize(row);
+    undoRecordText(UNDO_DELETE, y, at, &row->chars[at], len);
+    autosaveRecord(UNDO_DELETE, y, at, NULL, len);
+    char small[64];
+    char *deleted = len <= (int) sizeof(small) ? small : malloc(len); //rowRenderUpdate() needs the removed characters
+    if (deleted == NULL) quit("malloc");
+    memcpy(deleted, &row->chars[at], len);
+    memmove(&row->chars[at], &row->chars[at + len],
+            row->size - at - len + 1); //overwrites the deleted characters with the characters that come after them
+    row->size -= len;
+    rowStoreResize(y, -len);
+    rowRenderUpdate(row, at, 0, deleted, len);
+    if (deleted != small) free(deleted);
+    E.dirty++;
+    traceEnd("rowDeleteString", t);
+}
+
+/**
+ * This function replaces len characters of row y from index at on with the slen characters s. The new
+ * chars are built in one go and the render is updated once, where deleting and inserting would copy
+ * the rest of the row twice. A mapped row is copied straight into its new shape. The change is not
+ * recorded for undo, replaceAll() records all of its rows as one UNDO_REPLACE record.
+ * @param y
+ * @param at
+ * @param len
+ * @param s
+ * @param slen
+ */
+void rowReplaceString(int y, int at, int len, const char *s, int slen) {
+    erow *row = rowAt(y);
+    if (at < 0 || len < 0 || at + len > row->size) return;
+    long long t = traceBegin();
+    autosaveRecord(UNDO_DELETE, y, at, NULL, len);
+    autosaveRecord(UNDO_INSERT, y, at, s, slen);
+    char small[64];
+    char *deleted = len <= (int) sizeof(small) ? small : malloc(len); //rowRenderUpdate() needs the removed characters
+    if (deleted == NULL) quit("malloc");
+    memcpy(deleted, &row->chars[at], len);
+    int size = row->size - len + slen;
+    if (row->flags & ROW_MAPPED) { //the file stays as it is, the row gets its own chars
+        char *chars = textAlloc(size + 1, &row->ccap);
+        memcpy(chars, row->chars, at);
+        memcpy(&chars[at + slen], &row->chars[at + len], row->size - at - len);
+        chars[size] = '\0';
+        row->chars = chars;
+        if (row->flags & ROW_ALIAS) row->render = chars;
+        row->flags &= ~ROW_MAPPED;
+    } else {
+        row->chars = textRealloc(row->chars, &row->ccap, size + 1);
+        memmove(&row->chars[at + slen], &row->chars[at + len], row->size - at - len + 1);
+    }
+    if (slen > 0) memcpy(&row->chars[at], s, slen); //s may be NULL if nothing is inserted
+    row->size = size;
+    rowStoreResize(y, slen - len);
+    rowRenderUpdate(row, at, slen, deleted, len);
+    if (deleted != small) free(deleted);
+    E.dirty++;
+    traceEnd("rowReplaceString", t);
+}
+
+/**
+ * This function inserts a single character into a row at a given position.
+ * @param y the row we insert the character into
+ * @param at the index we want to insert characters into
+ * @param c position in the array
+ */
+void insertCharInRow(int y, int at, int c) {
+    char ch = c;
+    rowInsertString(y, at, &ch, 1);
+}
+
+/**
+ * This function appends a string to the end of the row.
+ * @param y
+ * @param s
+ * @param len
+ */
+void appendString(int y, char *s, size_t len) {
+    rowInsertString(y, rowAt(y)->size, s, len);
+}
+
+/**
+ * This function deletes a character in a row, all of its bytes if it isn't ASCII.
+ * @param y
+ * @param at index of the first byte of the character
+ */
+void rowDeleteChar(int y, int at) {
+    erow *row = rowAt(y);
+    int width;
+    rowDeleteString(y, at, utf8Decode(&row->chars[at], row->size - at, &width));
+}
+
+/**
+ * This function deletes the character left to the cursor.
+ */
+void deleteChar() {
+    if (E.cy == E.numrows) return; //if the cursor is past the end of file, nothing to delete.
+    if (E.cx == 0 && E.cy == 0) return; //if cursor is at the beginning of the first line, nothing to do.
+    if (E.cx > 0) { //if there is a character to the left of the cursor
+        erow *row = rowAt(E.cy);
+        int start = utf8Start(row->chars, row->size, E.cx - 1);
+        rowDeleteChar(E.cy, start); //delete the character and move the cursor in front of it
+        E.cx = start;
+    } else {
+        erow *row = rowAt(E.cy); //gets the erow the cursor is on
+        E.cx = rowAt(E.cy - 1)->size; //set E.cx to the end of the contents of the previous row before appending
+        appendString(E.cy - 1, row->chars, row->size); //append to the previous row
+        deleteRow(E.cy); //delete the row
+        E.cy--;
+    }
+}
+
+/*** editor operations ***/
+/**
+ * This function takes a character and uses editorRow() to insert that character
+ * into the position that the cursor is at.
+ * @param c position in the array
+ */
+void insertChar(int c) {
+    if (E.cy == E.numrows) { //if condition is true, then we append a new row to the file before inserting character
+        insertRow(E.numrows, "", 0);
+    }
+    insertCharInRow(E.cy, E.cx, c);
+    E.cx++; //moving the cursor forward, so that the next character we insert comes after the just inserted character
+}
+
+/**
+ * This function allows us to add a new line or break an existing line. This is done using the Enter key.
+ * If we are at the beginning of a line, we just have to insert a new empty line before the line we are in.
+ */
+void insertNewline() {
+   if (E.cx == 0) { //If we are at the beginning of a line
+       insertRow(E.cy, "", 0); //insert a new blank row
+   } else {
+       erow *row = rowAt(E.cy);
+       insertRow(E.cy + 1, &row->chars[E.cx],
+                 row->size - E.cx); //pass the characters on current row which are right of the cursor
+       rowDeleteString(E.cy, E.cx, rowAt(E.cy)->size - E.cx); //cut off current rows content at the cursor
+   }
+   E.cy++;
+   E.cx = 0; //move cursor to beginning of row
+}
+
+/*** undo ***/
+/**
+ * This function frees the records of a stack.
+ */
+void undoClear(struct undoStack *st) {
+    for (int j = 0; j < st->n; j++) {
+        E.undo.bytes -= sizeof(undoRecord) + st->recs[j].cap;
+        free(st->recs[j].text);
+    }
+    st->n = 0;
+}
+
+/**
+ * This function pushes a record onto a stack.
+ */
+void undoPush(struct undoStack *st, undoRecord *rec) {
+    if (st->n == st->cap) {
+        st->cap = st->cap ? st->cap * 2 : 64;
+        st->recs = realloc(st->recs, st->cap * sizeof(undoRecord));
+        if (st->recs == NULL) quit("realloc");
+    }
+    st->recs[st->n++] = *rec;
+}
+
+/**
+ * This function drops the oldest groups of changes until the journal uses at most three quarters
+ * of TECS_UNDO_LIMIT. If the group being recorded has to go as well, the rest of it is not recorded.
+ */
+void undoTrim() {
+    struct undoStack *st = &E.undo.undo;
+    int drop = 0;
+    while (drop < st->n && E.undo.bytes > TECS_UNDO_LIMIT / 4 * 3) {
+        int group = st->recs[drop].group;
+        while (drop < st->n && st->recs[drop].group == group) {
+            E.undo.bytes -= sizeof(undoRecord) + st->recs[drop].cap;
+            free(st->recs[drop].text);
+            drop++;
+        }
+        if (group == E.undo.group) E.undo.skip = group;
+    }
+    memmove(st->recs, &st->recs[drop], (st->n - drop) * sizeof(undoRecord));
+    st->n -= drop;
+}
+
+/**
+ * This function adds len bytes of s to the text of a record.
+ * @param rec
+ * @param front 1 to put them in front of the text, 0 to append them
+ */
+void undoAddText(undoRecord *rec, const char *s, int len, int front) {
+    if (len == 0) return;
+    if (rec->len + len > rec->cap) {
+        int cap = rec->cap * 2 > rec->len + len ? rec->cap * 2 : rec->len + len;
+        rec->text = realloc(rec->text, cap);
+        if (rec->text == NULL) quit("realloc");
+        E.undo.bytes += cap - rec->cap;
+        rec->cap = cap;
+    }
+    if (front) {
+        memmove(rec->text + len, rec->text, rec->len);
+        memcpy(rec->text, s, len);
+    } else {
+        memcpy(rec->text + rec->len, s, len);
+    }
+    rec->len += len;
+}
+
+/**
+ * This function returns the record a change of the key being handled can be merged into, or NULL.
+ * Records of the same key are merged, and so are records of directly following keys, which makes
+ * a run of typing or of backspaces one record.
+ */
+undoRecord *undoLast(int type) {
+    struct undoStack *st = &E.undo.undo;
+    if (st->n == 0) return NULL;
+    undoRecord *last = &st->recs[st->n - 1];
+    if (last->type != type) return NULL;
+    if (last->group == E.undo.group) return last;
+    if (last->group == E.undo.prevgroup && (type == UNDO_INSERT || type == UNDO_DELETE)) return last;
+    return NULL;
+}
+
+/**
+ * This function starts a new record of the key being handled.
+ */
+undoRecord *undoNew(int type, int row, int col) {
+    undoRecord rec = {type, E.undo.group, row, col, 0, 0, 0, NULL, E.undo.cx, E.undo.cy, E.cx, E.cy};
+    undoPush(&E.undo.undo, &rec);
+    E.undo.bytes += sizeof(undoRecord);
+    return &E.undo.undo.recs[E.undo.undo.n - 1];
+}
+
+/**
+ * This function returns 1 if changes are recorded right now. Nothing is recorded outside of a key
+ * (e.g. while the file is read), while undoing and redoing, and for a group which was dropped.
+ */
+int undoRecording() {
+    return E.undo.group != 0 && !E.undo.replaying && E.undo.group != E.undo.skip;
+}
+
+/**
+ * This function records that len characters s were inserted into (UNDO_INSERT) or deleted from
+ * (UNDO_DELETE) row at index col.
+ */
+void undoRecordText(int type, int row, int col, const char *s, int len) {
+    if (!undoRecording() || len == 0) return;
+    undoClear(&E.undo.redo); //a new change makes the undone changes unreachable
+    undoRecord *last = undoLast(type);
+    if (last && last->row == row) {
+        if (type == UNDO_INSERT && col == last->col + last->len &&
+            !(last->group != E.undo.group && last->len > 0 && isspace((unsigned char) last->text[last->len - 1]) &&
+              !isspace((unsigned char) s[0]))) { //typing a new word starts a new record
+            undoAddText(last, s, len, 0);
+        } else if (type == UNDO_DELETE && col + len == last->col) { //backspace
+            undoAddText(last, s, len, 1);
+            last->col = col;
+        } else if (type == UNDO_DELETE && col == last->col) { //delete key
+            undoAddText(last, s, len, 0);
+        } else {
+            last = NULL;
+        }
+    } else {
+        last = NULL;
+    }
+    if (last == NULL) undoAddText(undoNew(type, row, col), s, len, 0);
+    else E.undo.group = last->group; //the key continues the group of the previous key
+    undoTrim();
+}
+
+/**
+ * This function records that the row s was inserted (UNDO_INSERT_ROWS) or deleted (UNDO_DELETE_ROWS)
+ * at index row. Consecutive rows of the same key become one record, with the rows separated by '\n'.
+ */
+void undoRecordRows(int type, int row, const char *s, int len) {
+    if (!undoRecording()) return;
+    undoClear(&E.undo.redo);
+    undoRecord *last = undoLast(type);
+    if (last && last->group == E.undo.group &&
+        ((type == UNDO_INSERT_ROWS && row == last->row + last->nrows) || (type == UNDO_DELETE_ROWS && row == last->row))) {
+        undoAddText(last, "\n", 1, 0);
+    } else {
+        last = undoNew(type, row, 0);
+    }
+    undoAddText(last, s, len, 0);
+    last->nrows++;
+    undoTrim();
+}
+
+/**
+ * This function starts the record of a replacement of every query (qlen bytes) with with (wlen bytes).
+ * The matches are added with undoRecordMatch(), nothing else may be recorded until the replacement is done.
+ * @return the record, NULL if changes are not recorded
+ */
+undoRecord *undoRecordReplace(const char *query, int qlen, const char *with, int wlen) {
+    if (!undoRecording()) return NULL;
+    undoClear(&E.undo.redo);
+    undoRecord *rec = undoNew(UNDO_REPLACE, 0, 0);
+    undoAddText(rec, (const char *) &qlen, sizeof(int), 0);
+    undoAddText(rec, (const char *) &wlen, sizeof(int), 0);
+    undoAddText(rec, query, qlen, 0);
+    undoAddText(rec, with, wlen, 0);
+    return rec;
+}
+
+/**
+ * This function adds a match at row, col of the text before the replacement to a replace record.
+ */
+void undoRecordMatch(undoRecord *rec, int row, int col) {
+    int match[2] = {row, col};
+    undoAddText(rec, (const char *) match, sizeof(match), 0);
+    rec->nrows++;
+}
+
+/**
+ * This function does (forward 1) or reverts (forward 0) a replace record. Every row with matches is
+ * rebuilt once, the matches of a row are consecutive in the record.
+ */
+void undoReplace(undoRecord *rec, int forward) {
+    int qlen, wlen;
+    memcpy(&qlen, rec->text, sizeof(int));
+    memcpy(&wlen, rec->text + sizeof(int), sizeof(int));
+    const char *query = rec->text + 2 * sizeof(int);
+    const char *with = query + qlen;
+    const char *matches = with + wlen;
+    const char *to = forward ? with : query; //what the matches become
+    int flen = forward ? qlen : wlen, tlen = forward ? wlen : qlen;
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    for (int j = 0; j < rec->nrows;) {
+        int match[2];
+        memcpy(match, matches + j * sizeof(match), sizeof(match));
+        int y = match[0];
+        erow *row = rowAt(y);
+        int first = -1, end = 0; //the bytes from first to end are rebuilt
+        len = 0;
+        for (int k = 0; j < rec->nrows; j++, k++) {
+            memcpy(match, matches + j * sizeof(match), sizeof(match));
+            if (match[0] != y) break;
+            int col = forward ? match[1] : match[1] + k * (wlen - qlen); //where the match is in the row now
+            if (first == -1) first = col;
+            if (len + (col - end) + tlen > cap) {
+                cap = (len + (col - end) + tlen) * 2;
+                buf = realloc(buf, cap);
+                if (buf == NULL) quit("realloc");
+            }
+            if (k > 0) {
+                memcpy(buf + len, &row->chars[end], col - end); //the bytes between two matches stay
+                len += col - end;
+            }
+            if (tlen > 0) memcpy(buf + len, to, tlen); //buf is NULL until something is copied
+            len += tlen;
+            end = col + flen;
+        }
+        rowReplaceString(y, first, end - first, buf, len);
+    }
+    free(buf);
+}
+
+/**
+ * This function starts a group of changes, which is undone and redone as a whole. It is called for
+ * every key, so other keys, e.g. cursor movements, end a run of typing.
+ */
+void undoBegin() {
+    E.undo.group = ++E.undo.groups;
+    E.undo.cx = E.cx;
+    E.undo.cy = E.cy;
+}
+
+/**
+ * This function ends the group of changes of a key and remembers where the cursor went.
+ */
+void undoEnd() {
+    struct undoStack *st = &E.undo.undo;
+    if (st->n && st->recs[st->n - 1].group == E.undo.group) {
+        st->recs[st->n - 1].acx = E.cx;
+        st->recs[st->n - 1].acy = E.cy;
+    }
+    E.undo.prevgroup = E.undo.group;
+    E.undo.group = 0;
+}
+
+/**
+ * This function applies a record (forward 1) or reverts it (forward 0). Reverting the insertion of rows
+ * deletes them directly, so undoing a big paste takes time proportional to its size.
+ */
+void undoApply(undoRecord *rec, int forward) {
+    if (rec->type == UNDO_REPLACE) {
+        undoReplace(rec, forward);
+        return;
+    }
+    int insert = (rec->type == UNDO_INSERT || rec->type == UNDO_INSERT_ROWS) == forward;
+    if (rec->type == UNDO_INSERT || rec->type == UNDO_DELETE) {
+        if (insert) rowInsertString(rec->row, rec->col, rec->text, rec->len);
+        else rowDeleteString(rec->row, rec->col, rec->len);
+    } else if (insert) {
+        int at = rec->row;
+        for (int i = 0, j = 0; j <= rec->len; j++) {
+            if (j < rec->len && rec->text[j] != '\n') continue;
+            insertRow(at++, rec->len ? &rec->text[i] : "", j - i);
+            i = j + 1;
+        }
+    } else {
+        for (int j = 0; j < rec->nrows; j++) deleteRow(rec->row);
+    }
+}
+
+/**
+ * This function moves the cursor to cx, cy after an undo or redo, it stays inside the file.
+ */
+void undoCursor(int cx, int cy) {
+    E.cy = cy > E.numrows ? E.numrows : cy;
+    int size = E.cy < E.numrows ? rowAt(E.cy)->size : 0;
+    E.cx = cx > size ? size : cx;
+}
+
+/**
+ * This function undoes the last group of changes (forward 0) or redoes the last undone group (forward 1).
+ */
+void undoStep(int forward) {
+    struct undoStack *from = forward ? &E.undo.redo : &E.undo.undo;
+    struct undoStack *to = forward ? &E.undo.undo : &E.undo.redo;
+    if (from->n == 0) {
+        setStatusMessage(forward ? "Nothing to redo" : "Nothing to undo");
+        return;
+    }
+    int group = from->recs[from->n - 1].group;
+    E.undo.replaying = 1;
+    undoRecord rec;
+    while (from->n && from->recs[from->n - 1].group == group) {
+        rec = from->recs[--from->n];
+        undoApply(&rec, forward);
+        undoPush(to, &rec);
+    }
+    E.undo.replaying = 0;
+    if (forward) undoCursor(rec.acx, rec.acy);
+    else undoCursor(rec.cx, rec.cy);
+}
+
+/*** loader ***/
+/**
+ * Returns a monotonic timestamp in milliseconds.
+ */
+long long monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * This function records a newline found at offset off inside the chunk.
+ * @param c
+ * @param off
+ */
+void chunkAddLine(loadChunk *c, size_t off) {
+    if (c->nlines == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 4096;
+        c->lines = realloc(c->lines, sizeof(uint32_t) * c->cap);
+        if (c->lines == NULL) quit("realloc");
+    }
+    c->lines[c->nlines++] = off;
+}
+
+/**
+ * This function finds all newlines of a chunk. With SSE2 it compares 64 bytes per iteration
+ * and only looks at the single bytes of blocks which contain a newline,
+ * otherwise (and for the tail of the chunk) it uses memchr().
+ * @param c
+ */
+void scanChunk(loadChunk *c) {
+    const char *base = E.map + c->begin;
+    size_t n = c->end - c->begin;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (base + i)), nl);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (base + i + 16)), nl);
+        __m128i x = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (base + i + 32)), nl);
+        __m128i y = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (base + i + 48)), nl);
+        if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(x, y)))) continue;
+        uint64_t mask = (uint64_t) (unsigned) _mm_movemask_epi8(a)
+                        | (uint64_t) (unsigned) _mm_movemask_epi8(b) << 16
+                        | (uint64_t) (unsigned) _mm_movemask_epi8(x) << 32
+                        | (uint64_t) (unsigned) _mm_movemask_epi8(y) << 48;
+        while (mask) { //one bit per newline
+            chunkAddLine(c, i + __builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while (i < n) {
+        const char *p = memchr(base + i, '\n', n - i);
+        if (p == NULL) break;
+        chunkAddLine(c, p - base);
+        i = p - base + 1;
+    }
+    atomic_fetch_add(&E.load.lines, c->nlines);
+    atomic_store_explicit(&c->done, 1, memory_order_release);
+}
+
+/**
+ * Loader thread. Claims chunks until every chunk of the file has been scanned.
+ */
+void *loaderThread(void *arg) {
+    (void) arg;
+    int i;
+    while ((i = atomic_fetch_add(&E.load.next, 1)) < E.load.nchunks) {
+        long long t = traceBegin();
+        scanChunk(&E.load.chunks[i]);
+        traceEnd("scanChunk", t);
+    }
+    return NULL;
+}
+
+/**
+ * This function turns the line from E.load.pos up to the offset eol into a mapped row.
+ * @param eol offset of the end of the line
+ */
+void loaderAddRow(size_t eol) {
+    char *p = E.map + E.load.pos;
+    size_t linelen = eol - E.load.pos;
+    while (linelen > 0 && p[linelen - 1] == '\r') linelen--;
+    insertMappedRow(E.load.at++, p, linelen);
+    E.load.pos = eol + 1;
+}
+
+/**
+ * This function splits the mapped file into chunks, scans the first chunk right away and starts
+ * loader threads for the rest. The rows of the first chunk exist when this function returns.
+ */
+void loaderStart() {
+    struct loader *l = &E.load;
+    l->nchunks = (E.mapsize + TECS_LOAD_CHUNK - 1) / TECS_LOAD_CHUNK;
+    l->chunks = calloc(l->nchunks, sizeof(loadChunk));
+    if (l->chunks == NULL) quit("calloc");
+    for (int i = 0; i < l->nchunks; i++) {
+        l->chunks[i].begin = (size_t) i * TECS_LOAD_CHUNK;
+        l->chunks[i].end = i == l->nchunks - 1 ? E.mapsize : (size_t) (i + 1) * TECS_LOAD_CHUNK;
+    }
+    l->active = 1;
+    l->stitched = 0;
+    l->line = 0;
+    l->pos = 0;
+    l->at = E.numrows;
+    atomic_store(&l->lines, 0);
+    atomic_store(&l->next, 1);
+    scanChunk(&l->chunks[0]); //the first screen comes from the first chunk
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN) - 1; //the main thread creates the rows
+    if (cpus < 1) cpus = 1;
+    if (cpus > TECS_LOAD_THREADS) cpus = TECS_LOAD_THREADS;
+    if (cpus > l->nchunks - 1) cpus = l->nchunks - 1;
+    l->nthreads = 0;
+    for (int i = 0; i < cpus; i++)
+        if (pthread_create(&l->threads[l->nthreads], NULL, loaderThread, NULL) == 0) l->nthreads++;
+    if (l->nthreads == 0) loaderThread(NULL); //no threads available, scan everything now
+
+    loaderStep(TECS_LOAD_STEP);
+}
+
+/**
+ * This function creates up to budget rows from chunks which have been scanned already.
+ * When the last chunk is done, the loader threads are joined and the loader gets cleaned up.
+ * @param budget maximum number of rows to create
+ * @return number of rows created
+ */
+int loaderStep(int budget) {
+    struct loader *l = &E.load;
+    if (!l->active) return 0;
+    int made = 0;
+    while (made < budget && l->stitched < l->nchunks) {
+        loadChunk *c = &l->chunks[l->stitched];
+        if (!atomic_load_explicit(&c->done, memory_order_acquire)) break; //not scanned yet
+        while (l->line < c->nlines && made < budget) {
+            loaderAddRow(c->begin + c->lines[l->line++]);
+            made++;
+        }
+        if (l->line == c->nlines) {
+            free(c->lines);
+            c->lines = NULL;
+            l->stitched++;
+            l->line = 0;
+        }
+    }
+    if (l->stitched == l->nchunks) {
+        if (l->pos < E.mapsize) loaderAddRow(E.mapsize); //last line without a newline
+        for (int i = 0; i < l->nthreads; i++) pthread_join(l->threads[i], NULL);
+        free(l->chunks);
+        l->chunks = NULL;
+        l->active = 0;
+    }
+    return made;
+}
+
+/**
+ * This function waits until all rows of the file have been created.
+ */
+void loaderFinish() {
+    if (!E.load.active) return;
+    for (int i = 0; i < E.load.nthreads; i++) pthread_join(E.load.threads[i], NULL);
+    E.load.nthreads = 0;
+    if (E.load.next < E.load.nchunks) loaderThread(NULL); //scan what the threads left
+    while (E.load.active) loaderStep(E.numrows + 1);
+}
+
+/**
+ * This function inserts a block of text at the cursor, e.g. a paste. Line breaks (\r, \n or \r\n)
+ * split it into rows. Every affected row is built once instead of inserting the text key by key.
+ * @param s
+ * @param len
+ */
+void insertText(char *s, int len) {
+    if (len == 0) return;
+    if (E.cy == E.numrows) insertRow(E.numrows, "", 0);
+    erow *row = rowAt(E.cy);
+    int taillen = row->size - E.cx; //text right of the cursor ends up behind the inserted text
+    char *tail = malloc(taillen + 1);
+    if (tail == NULL) quit("malloc");
+    memcpy(tail, &row->chars[E.cx], taillen);
+    rowDeleteString(E.cy, E.cx, taillen);
+    int i = 0;
+    while (1) {
+        int j = i;
+        while (j < len && s[j] != '\r' && s[j] != '\n') j++;
+        if (i == 0) appendString(E.cy, s, j); //first line continues the current row
+        else insertRow(++E.cy, &s[i], j - i);
+        if (j == len) break;
+        if (s[j] == '\r' && j + 1 < len && s[j + 1] == '\n') j++;
+        i = j + 1;
+    }
+    E.cx = rowAt(E.cy)->size;
+    appendString(E.cy, tail, taillen);
+    free(tail);
+}
+
+/*** autosave ***/
+/**
+ * This function appends len bytes to a growing buffer.
+ */
+void autosaveAppend(char **buf, int *len, int *cap, const void *s, int n) {
+    if (*len + n > *cap) {
+        int cap2 = *cap ? *cap : 4096;
+        while (cap2 < *len + n) cap2 *= 2;
+        char *new = realloc(*buf, cap2);
+        if (new == NULL) quit("realloc");
+        *buf = new;
+        *cap = cap2;
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+}
+
+/**
+ * Returns the journal file of filename: .name.tecs-swp in the same directory. Must be freed.
+ */
+char *autosavePath(const char *filename) {
+    const char *slash = strrchr(filename, '/');
+    int dirlen = slash ? slash - filename + 1 : 0;
+    int size = strlen(filename) + 12;
+    char *path = malloc(size);
+    if (path == NULL) quit("malloc");
+    snprintf(path, size, "%.*s.%s.tecs-swp", dirlen, filename, filename + dirlen);
+    return path;
+}
+
+/**
+ * This function fills in the header for the file as it is on disk now.
+ * @return -1 if the file can't be found
+ */
+int autosaveHeaderOf(const char *filename, autosaveHeader *h) {
+    struct stat st;
+    if (stat(filename, &st) == -1) return -1;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, AUTOSAVE_MAGIC, sizeof(h->magic));
+    h->size = st.st_size;
+    h->mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+/**
+ * The autosave thread. It writes the queued records to the journal and syncs it, the editor never
+ * waits for the disk. A failing write only costs the crash protection, so errors are ignored.
+ */
+void *autosaveThread(void *arg) {
+    struct autosave *a = arg;
+    char *buf = NULL;
+    int cap = 0, fd = -1;
+    pthread_mutex_lock(&a->lock);
+    while (1) {
+        while (!a->stop && a->qlen == 0 && !a->restart) pthread_cond_wait(&a->wake, &a->lock);
+        if (a->qlen == 0 && !a->restart) break; //stopped
+        char *swap = buf; //take the queued records, the editor queues into the old buffer
+        buf = a->queued;
+        a->queued = swap;
+        int len = a->qlen, restart = a->restart, tmp = cap;
+        cap = a->qcap;
+        a->qcap = tmp;
+        a->qlen = 0;
+        a->restart = 0;
+        pthread_mutex_unlock(&a->lock);
+
+        if (restart && len == 0) { //saved, the journal is not needed anymore
+            if (fd != -1) close(fd);
+            fd = -1;
+            unlink(a->path);
+        } else if (restart && fd != -1) {
+            if (ftruncate(fd, 0) == -1) len = 0;
+        }
+        if (len && fd == -1) fd = open(a->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (restart ? O_TRUNC : 0), 0600);
+        if (len && fd != -1) {
+            struct iovec iov = {buf, len};
+            if (writeAll(fd, &iov, 1) == 0) fdatasync(fd);
+        }
+        pthread_mutex_lock(&a->lock);
+    }
+    pthread_mutex_unlock(&a->lock);
+    if (fd != -1) close(fd);
+    free(buf);
+    return NULL;
+}
+
+/**
+ * This function hands the pending records to the autosave thread, which is started on first use.
+ * Called by a timer once no key was pressed for TECS_AUTOSAVE_IDLE milliseconds.
+ */
+void autosaveFlush() {
+    struct autosave *a = &E.autosave;
+    if (a->plen == 0 && !a->truncate) return;
+    if (!a->running) {
+        pthread_mutex_init(&a->lock, NULL);
+        pthread_cond_init(&a->wake, NULL);
+        if (pthread_create(&a->thread, NULL, autosaveThread, a) != 0) quit("pthread_create");
+        a->running = 1;
+    }
+    pthread_mutex_lock(&a->lock);
+    if (a->truncate) { //a new journal replaces what the thread has not written yet
+        a->qlen = 0;
+        a->restart = 1;
+        a->truncate = 0;
+    }
+    autosaveAppend(&a->queued, &a->qlen, &a->qcap, a->pending, a->plen);
+    pthread_cond_signal(&a->wake);
+    pthread_mutex_unlock(&a->lock);
+    a->plen = 0;
+}
+
+/**
+ * This function appends a change of the rows to the journal. The first change after the file was
+ * opened or saved starts a new journal.
+ * @param type UNDO_INSERT, UNDO_DELETE, UNDO_INSERT_ROWS or UNDO_DELETE_ROWS
+ * @param row
+ * @param col
+ * @param s inserted text, NULL for deletions
+ * @param len length of s or number of deleted characters
+ */
+void autosaveRecord(int type, int row, int col, const char *s, int len) {
+    struct autosave *a = &E.autosave;
+    if (E.filename == NULL || a->replaying) return;
+    if (!a->started) {
+        autosaveHeader h;
+        if (autosaveHeaderOf(E.filename, &h) == -1) return; //not on disk yet, nothing to recover to
+        if (a->path == NULL) a->path = autosavePath(E.filename);
+        a->plen = 0;
+        autosaveAppend(&a->pending, &a->plen, &a->pcap, &h, sizeof(h));
+        a->started = 1;
+        a->truncate = 1;
+    }
+    autosaveEntry rec = {type, row, col, len};
+    autosaveAppend(&a->pending, &a->plen, &a->pcap, &rec, sizeof(rec));
+    if (s) autosaveAppend(&a->pending, &a->plen, &a->pcap, s, len);
+    if (a->plen >= TECS_AUTOSAVE_BATCH) autosaveFlush();
+    else timerStart(TIMER_AUTOSAVE, TECS_AUTOSAVE_IDLE, autosaveFlush);
+}
+
+/**
+ * This function drops the journal after the file was saved. The next change starts a new one.
+ */
+void autosaveSaved() {
+    struct autosave *a = &E.autosave;
+    if (!a->started) return;
+    a->started = 0;
+    a->plen = 0;
+    timerStop(TIMER_AUTOSAVE);
+    if (!a->running) return;
+    pthread_mutex_lock(&a->lock);
+    a->qlen = 0;
+    a->restart = 1;
+    pthread_cond_signal(&a->wake);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**
+ * This function stops the autosave thread and deletes the journal. Called when the user quits,
+ * unsaved changes are dropped on purpose then.
+ */
+void autosaveClose() {
+    struct autosave *a = &E.autosave;
+    if (a->running) {
+        pthread_mutex_lock(&a->lock);
+        a->stop = 1;
+        pthread_cond_signal(&a->wake);
+        pthread_mutex_unlock(&a->lock);
+        pthread_join(a->thread, NULL);
+        a->running = 0;
+    }
+    if (a->path) unlink(a->path);
+}
+
+/**
+ * This function looks for a journal of the file which was just opened. If it belongs to the file as it
+ * is on disk, its changes are applied to the rows, so the editor continues where it crashed. A record
+ * which was only partly written ends the replay and is cut off, later changes are appended to the journal.
+ * @return the number of changes recovered
+ */
+int autosaveRecover() {
+    struct autosave *a = &E.autosave;
+    a->path = autosavePath(E.filename);
+    int fd = open(a->path, O_RDWR | O_CLOEXEC);
+    if (fd == -1) return 0;
+    struct stat st;
+    autosaveHeader h, disk;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(h) ||
+        autosaveHeaderOf(E.filename, &disk) == -1 || read(fd, &h, sizeof(h)) != sizeof(h) ||
+        memcmp(&h, &disk, sizeof(h)) != 0) { //another file, or the file changed since
+        close(fd);
+        return 0;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    loaderFinish(); //the records may refer to any row
+    a->replaying = 1;
+    size_t pos = sizeof(h);
+    int changes = 0;
+    while (pos + sizeof(autosaveEntry) <= (size_t) st.st_size) {
+        autosaveEntry rec;
+        memcpy(&rec, map + pos, sizeof(rec));
+        int hastext = rec.type == UNDO_INSERT || rec.type == UNDO_INSERT_ROWS;
+        if (rec.type < UNDO_INSERT || rec.type > UNDO_DELETE_ROWS || rec.len < 0 ||
+            (hastext && pos + sizeof(rec) + rec.len > (size_t) st.st_size))
+            break; //torn or damaged
+        const char *text = map + pos + sizeof(rec);
+        int rows = rec.type == UNDO_INSERT_ROWS ? E.numrows + 1 : E.numrows;
+        if (rec.row < 0 || rec.row >= rows) break;
+        if (rec.type == UNDO_INSERT || rec.type == UNDO_DELETE) {
+            erow *row = rowAt(rec.row);
+            if (rec.col < 0 || rec.col > row->size || (rec.type == UNDO_DELETE && rec.col + rec.len > row->size)) break;
+        }
+        switch (rec.type) {
+            case UNDO_INSERT:
+                rowInsertString(rec.row, rec.col, text, rec.len);
+                break;
+            case UNDO_DELETE:
+                rowDeleteString(rec.row, rec.col, rec.len);
+                break;
+            case UNDO_INSERT_ROWS:
+                insertRow(rec.row, (char *) text, rec.len);
+                break;
+            case UNDO_DELETE_ROWS:
+                deleteRow(rec.row);
+                break;
+        }
+        pos += sizeof(rec) + (hastext ? rec.len : 0);
+        changes++;
+    }
+    a->replaying = 0;
+    munmap(map, st.st_size);
+    ftruncate(fd, pos); //cut off a torn record
+    close(fd);
+    a->started = changes > 0;
+    return changes;
+}
+
+/*** follow ***/
+/**
+ * This function watches the followed file and its directory. Without inotify the file is checked by a timer.
+ */
+void followWatch() {
+    struct follow *f = &E.follow;
+#ifdef __linux__
+    if (f->inotify == -1) {
+        f->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (f->inotify == -1) {
+            timerStart(TIMER_FOLLOW, TECS_FOLLOW_POLL, followTick);
+            return;
+        }
+        char *dir = strdup(E.filename);
+        if (dir == NULL) quit("strdup");
+        char *slash = strrchr(dir, '/');
+        if (slash) slash[slash == dir] = '\0'; //keep the / of a file in the root directory
+        f->wddir = inotify_add_watch(f->inotify, slash ? dir : ".", IN_CREATE | IN_MOVED_TO);
+        free(dir);
+    }
+    if (f->wdfile != -1) inotify_rm_watch(f->inotify, f->wdfile);
+    f->wdfile = inotify_add_watch(f->inotify, E.filename, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+#else
+    timerStart(TIMER_FOLLOW, TECS_FOLLOW_POLL, followTick);
+#endif
+}
+
+/**
+ * This function opens the file at E.filename again, after it was replaced or saved.
+ * @param offset bytes of the new file which are already rows
+ */
+void followReopen(off_t offset) {
+    struct follow *f = &E.follow;
+    if (f->fd != -1) close(f->fd);
+    f->fd = open(E.filename, O_RDONLY | O_CLOEXEC);
+    f->offset = offset;
+    f->open = 0; //the new file starts a new row
+    f->pending = 1;
+    followWatch();
+}
+
+/**
+ * This function starts following the file which was just read. The rows end where the file ended.
+ */
+void followStart() {
+    struct follow *f = &E.follow;
+    f->fd = f->inotify = f->wdfile = f->wddir = -1;
+    f->buf = malloc(TECS_LOAD_CHUNK);
+    if (f->buf == NULL) quit("malloc");
+    struct stat st;
+    if (E.filename == NULL || stat(E.filename, &st) == -1 || !S_ISREG(st.st_mode)) {
+        f->on = 0;
+        setStatusMessage("Follow mode needs a regular file");
+        return;
+    }
+    followReopen(E.map ? (off_t) E.mapsize : st.st_size);
+    char last; //a file read with getline() has no map, its last byte is read again
+    f->open = f->fd != -1 && f->offset > 0 && pread(f->fd, &last, 1, f->offset - 1) == 1 && last != '\n';
+}
+
+/**
+ * This function notices when the followed file was replaced (rotated) or truncated. Rows which
+ * are already there stay. Like tail -F, both a replaced and a truncated file are read again from
+ * offset 0: a log truncated in place (e.g. logrotate copytruncate) is written again from its start,
+ * so whatever it already holds when the truncation is noticed is new.
+ */
+void followCheck() {
+    struct follow *f = &E.follow;
+    struct stat st, cur;
+    f->pending = 1;
+    if (stat(E.filename, &st) == -1) return; //moved away, wait until the new file appears
+    if (f->fd == -1 || fstat(f->fd, &cur) == -1 || cur.st_ino != st.st_ino || cur.st_dev != st.st_dev) {
+        if (f->fd != -1) {
+            while (followRead() != -1); //what was written to the old file before it was replaced
+        }
+        followReopen(0);
+        setStatusMessage("%.40s has been replaced, following the new file", E.filename);
+    } else if (cur.st_size < f->offset) {
+        f->offset = 0; //new lines are written from the start
+        f->open = 0;
+        setStatusMessage("%.40s was truncated", E.filename);
+    }
+}
+
+/**
+ * Timer of the follow mode: checks the file without inotify, and in any case makes the event loop redraw.
+ */
+void followTick() {
+    if (!E.follow.on) return;
+    followCheck();
+    if (E.follow.inotify == -1) timerStart(TIMER_FOLLOW, TECS_FOLLOW_POLL, followTick);
+}
+
+/**
+ * This function handles the events of the inotify instance.
+ */
+void followEvents() {
+    char buf[4096];
+    while (read(E.follow.inotify, buf, sizeof(buf)) > 0); //what happened doesn't matter, the file is checked
+    followCheck();
+}
+
+/**
+ * This function reads up to TECS_FOLLOW_STEP bytes the followed file grew by and appends them as rows.
+ * A cursor on the last row moves along with the end of the file. Rows can't change while the loader or
+ * the search thread is busy, the bytes are read later then.
+ * @return -1 if nothing was read, 1 if the screen shows a changed row, 0 otherwise
+ */
+int followRead() {
+    struct follow *f = &E.follow;
+    if (!f->pending || f->fd == -1 || E.load.active || E.search.running) return -1;
+    long long t = traceBegin();
+    int attail = E.cy >= E.numrows - 1;
+    int first = f->open ? E.numrows - 1 : E.numrows; //first row which changes
+    size_t total = 0;
+    while (total < TECS_FOLLOW_STEP) {
+        ssize_t n = pread(f->fd, f->buf, TECS_LOAD_CHUNK, f->offset);
+        if (n <= 0) {
+            f->pending = 0; //all read
+            break;
+        }
+        f->offset += n;
+        total += n;
+        char *p = f->buf, *end = f->buf + n;
+        while (p < end) {
+            char *nl = memchr(p, '\n', end - p);
+            char *eol = nl ? nl : end;
+            int len = eol - p;
+            if (nl && len > 0 && p[len - 1] == '\r') len--;
+            if (f->open && E.numrows > 0) extendFileRow(E.numrows - 1, p, len);
+            else appendFileRow(p, len);
+            f->open = nl == NULL;
+            p = nl ? nl + 1 : end;
+        }
+    }
+    traceEnd("followRead", t);
+    if (total == 0) return -1;
+    if (attail) { //follow the end
+        E.cy = E.numrows > 0 ? E.numrows - 1 : 0;
+        E.cx = 0;
+        return 1;
+    }
+    return first < E.rowoff + E.screenrows;
+}
+
+/**
+ * This function makes the follow mode continue after the file was saved, which replaced it.
+ * @param size bytes written
+ */
+void followSaved(long long size) {
+    if (E.follow.on) followReopen(size);
+}
+
+/*** view ***/
+/**
+ * This function reads up to len bytes of the viewed file at off. Safe to call from any thread.
+ * @return bytes read, less than len only at the end of the file
+ */
+size_t viewRead(char *buf, size_t len, off_t off) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = pread(E.view.fd, buf + got, len - got, off + got);
+        if (n <= 0) break;
+        got += n;
+    }
+    return got;
+}
+
+/**
+ * Returns the offset of the start of the line which contains at. A line longer than the window is
+ * cut into pieces. Safe to call from any thread.
+ */
+off_t viewLineStart(off_t at) {
+    char buf[65536];
+    off_t to = at, limit = at > (off_t) E.view.window ? at - (off_t) E.view.window : 0;
+    while (to > limit) {
+        off_t from = to - (off_t) sizeof(buf) > limit ? to - (off_t) sizeof(buf) : limit;
+        size_t n = viewRead(buf, to - from, from);
+        char *nl = memrchr(buf, '\n', n);
+        if (nl) return from + (nl - buf) + 1;
+        to = from;
+    }
+    return limit;
+}
+
+/**
+ * The index thread. It reads the whole file once and keeps the offset of every TECS_VIEW_STRIDE-th line.
+ */
+void *viewIndexThread(void *arg) {
+    struct view *v = arg;
+    char *buf = malloc(TECS_LOAD_CHUNK);
+    if (buf == NULL) return NULL;
+    off_t pos = 0;
+    long long line = 0;
+    char last = '\n';
+    while (pos < v->size && !atomic_load(&v->stop)) {
+        size_t n = viewRead(buf, TECS_LOAD_CHUNK, pos);
+        if (n == 0) break;
+        for (char *p = buf, *end = buf + n; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+            if (++line % TECS_VIEW_STRIDE) continue;
+            pthread_mutex_lock(&v->lock);
+            if (v->nindex == v->capindex) {
+                v->capindex *= 2;
+                off_t *index = realloc(v->index, v->capindex * sizeof(off_t));
+                if (index == NULL) quit("realloc");
+                v->index = index;
+            }
+            v->index[v->nindex++] = pos + (p - buf) + 1;
+            pthread_mutex_unlock(&v->lock);
+        }
+        last = buf[n - 1];
+        posix_fadvise(v->fd, pos, n, POSIX_FADV_DONTNEED); //the index doesn't need these pages in the cache
+        pos += n;
+        atomic_store(&v->indexed, pos);
+    }
+    if (pos >= v->size) atomic_store(&v->lines, line + (last != '\n'));
+    free(buf);
+    return NULL;
+}
+
+/**
+ * Returns the number of the line which starts at off, -1 if the index hasn't got that far yet.
+ */
+long long viewLineOf(off_t off) {
+    struct view *v = &E.view;
+    if (off > atomic_load(&v->indexed)) return -1;
+    pthread_mutex_lock(&v->lock);
+    size_t lo = 0, hi = v->nindex; //the last entry at or before off
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (v->index[mid] <= off) lo = mid;
+        else hi = mid;
+    }
+    off_t pos = v->index[lo];
+    pthread_mutex_unlock(&v->lock);
+    long long line = (long long) lo * TECS_VIEW_STRIDE;
+    char buf[65536];
+    while (pos < off) { //count the lines from the entry up to off
+        size_t n = viewRead(buf, off - pos < (off_t) sizeof(buf) ? off - pos : (off_t) sizeof(buf), pos);
+        if (n == 0) break;
+        for (char *p = buf, *end = buf + n; (p = memchr(p, '\n', end - p)) != NULL; p++) line++;
+        pos += n;
+    }
+    return line;
+}
+
+/**
+ * Returns the offset of line number line, -1 if the index hasn't got that far yet or the file is shorter.
+ */
+off_t viewOffsetOf(long long line) {
+    struct view *v = &E.view;
+    pthread_mutex_lock(&v->lock);
+    size_t k = line / TECS_VIEW_STRIDE;
+    off_t pos = k < v->nindex ? v->index[k] : -1;
+    pthread_mutex_unlock(&v->lock);
+    if (pos == -1) return -1;
+    long long skip = line % TECS_VIEW_STRIDE;
+    char buf[65536];
+    while (skip > 0) { //skip the lines from the entry on
+        size_t n = viewRead(buf, sizeof(buf), pos);
+        if (n == 0) return -1;
+        char *p = buf, *end = buf + n;
+        while (skip > 0 && (p = memchr(p, '\n', end - p)) != NULL) {
+            p++;
+            skip--;
+        }
+        pos += skip > 0 ? (off_t) n : p - buf;
+    }
+    return pos < v->size || line == 0 ? pos : -1;
+}
+
+/**
+ * Returns the offset in the file of row y of the window.
+ */
+off_t viewRowOffset(int y) {
+    if (y >= E.numrows) return E.view.end;
+    return E.view.start + (rowAt(y)->chars - E.view.buf);
+}
+
+/**
+ * This function makes the part of the file around at the rows, unless the window already is there, and
+ * puts the cursor on the row of at.
+ * @param at offset in the file
+ * @param line number of the line at at, -1 if not known
+ */
+void viewLoad(off_t at, long long line) {
+    struct view *v = &E.view;
+    at = viewLineStart(at);
+    off_t start = at > (off_t) v->window / 4 ? viewLineStart(at - v->window / 4) : 0;
+    if (at - start > (off_t) v->window / 2) start = at; //long lines before at
+    if (start != v->loaded || E.numrows == 0) {
+        long long t = traceBegin();
+        v->loaded = start;
+        size_t n = viewRead(v->buf, v->window, start);
+        if (start + (off_t) n < v->size) { //the last line of the window must be complete
+            char *nl = memrchr(v->buf, '\n', n);
+            if (nl && start + (nl - v->buf) >= at) n = nl - v->buf + 1;
+        }
+        size_t skip = at - start; //short lines: only a quarter of the rows may come before at
+        for (size_t k = 0; skip > 0 && k < v->maxrows / 4; k++) {
+            char *nl = skip > 1 ? memrchr(v->buf, '\n', skip - 1) : NULL;
+            skip = nl ? (size_t) (nl - v->buf) + 1 : 0;
+        }
+        memmove(v->buf, v->buf + skip, n - skip);
+        start += skip;
+        n -= skip;
+        while (E.numrows > 0) {
+            editorFreeRow(rowAt(E.numrows - 1));
+            rowStoreDelete(E.numrows - 1);
+        }
+        char *p = v->buf, *end = v->buf + n;
+        while (p < end && (size_t) E.numrows < v->maxrows) {
+            char *nl = memchr(p, '\n', end - p);
+            char *eol = nl ? nl : end;
+            int len = eol - p;
+            if (len > 0 && p[len - 1] == '\r') len--;
+            insertMappedRow(E.numrows, p, len);
+            p = eol + 1;
+        }
+        v->start = start;
+        v->end = start + (p < end ? p - v->buf : (off_t) n);
+        v->firstline = -1;
+        traceEnd("viewLoad", t);
+    }
+    int lo = 0, hi = E.numrows; //the row of at
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (viewRowOffset(mid) <= at) lo = mid;
+        else hi = mid;
+    }
+    E.cy = lo;
+    E.cx = 0;
+    if (line >= 0) v->firstline = line - lo;
+    if (v->firstline == -1) v->firstline = viewLineOf(v->start);
+}
+
+/**
+ * This function moves the window along when the cursor comes near one of its ends. Called before
+ * every frame.
+ */
+void viewSlide() {
+    struct view *v = &E.view;
+    if (v->firstline == -1 && v->start <= atomic_load(&v->indexed)) v->firstline = viewLineOf(v->start);
+    int margin = 2 * E.screenrows;
+    if (E.numrows == 0 || !((E.cy < margin && v->start > 0) || (E.cy >= E.numrows - margin && v->end < v->size)))
+        return;
+    int y = E.cy < E.numrows ? E.cy : E.numrows - 1;
+    int below = E.cy - y, screeny = E.cy - E.rowoff, cx = E.cx;
+    viewLoad(viewRowOffset(y), v->firstline >= 0 ? v->firstline + y : -1);
+    E.cy += below;
+    E.cx = cx;
+    E.rowoff = E.cy - screeny > 0 ? E.cy - screeny : 0;
+}
+
+/**
+ * This function opens filename read-only as a view. Nothing but the first window is read.
+ * @return -1 if filename is no regular file
+ */
+int viewOpen(const char *filename) {
+    struct view *v = &E.view;
+    struct stat st;
+    v->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (v->fd == -1 || fstat(v->fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (v->fd != -1) close(v->fd);
+        return -1;
+    }
+    v->size = st.st_size;
+    v->buf = malloc(v->window);
+    v->capindex = 1024;
+    v->index = malloc(v->capindex * sizeof(off_t));
+    if (v->buf == NULL || v->index == NULL) quit("malloc");
+    v->index[0] = 0;
+    v->nindex = 1;
+    atomic_store(&v->indexed, 0);
+    atomic_store(&v->lines, -1);
+    pthread_mutex_init(&v->lock, NULL);
+    if (pthread_create(&v->thread, NULL, viewIndexThread, v) != 0) quit("pthread_create");
+    v->maxrows = v->window / (sizeof(rowBlock) / TECS_ROW_BLOCK); //the blocks of a window are full
+    v->loaded = -1;
+    viewLoad(0, 0);
+    return 0;
+}
+
+/**
+ * This function asks for a line number or a percentage of the file and moves the window there.
+ */
+void viewGoto() {
+    struct view *v = &E.view;
+    char *input = inputFileName("Go to: %s (line, percent like 50%% or @byte offset, ESC to cancel)", NULL);
+    infoBar();
+    if (input == NULL) return;
+    long long n = atoll(input);
+    off_t at;
+    long long line = -1;
+    if (input[0] == '@' || strchr(input, '%')) {
+        if (input[0] == '@') at = atoll(input + 1);
+        else at = n >= 100 ? v->size : (off_t) ((double) v->size * n / 100);
+        if (at >= v->size) at = v->size - 1; //the last line
+        if (at < 0) at = 0;
+    } else {
+        line = n > 0 ? n - 1 : 0;
+        at = viewOffsetOf(line);
+        if (at == -1) {
+            long long lines = atomic_load(&v->lines);
+            if (lines >= 0) setStatusMessage("The file has %lld lines", lines);
+            else setStatusMessage("Line %lld isn't indexed yet (%d%% done), try a percentage",
+                                  n, (int) (atomic_load(&v->indexed) * 100 / (v->size ? v->size : 1)));
+            free(input);
+            return;
+        }
+    }
+    free(input);
+    viewLoad(at, line);
+    E.rowoff = E.cy;
+}
+
+/**
+ * This function handles the keys of --view before checkKeyPress() does: Ctrl-G jumps, keys which would
+ * change the file are refused.
+ * @return 1 if the key has been handled
+ */
+int viewKeypress(int c) {
+    switch (c) {
+        case CTRL_KEY('g'):
+            viewGoto();
+            return 1;
+        case CTRL_KEY('q'):
+        case CTRL_KEY('i'):
+        case CTRL_KEY('f'):
+        case CTRL_KEY('n'):
+        case HOME_KEY:
+        case END_KEY:
+        case PAGE_UP:
+        case PAGE_DOWN:
+        case ARROW_UP:
+        case ARROW_DOWN:
+        case ARROW_LEFT:
+        case ARROW_RIGHT:
+        case '\x1b':
+            return 0;
+        default:
+            setStatusMessage("Read-only view: Ctrl-G go to, Ctrl-F search, Ctrl-Q quit");
+            return 1;
+    }
+}
+
+/*** append buffer ***/
 /**
  * An append buffer consists of a pointer to our buffer in memory, and a length.
+ * The memory grows geometrically and is kept when the buffer is emptied, so a buffer which is
+ * reused for every frame stops allocating once it has seen the largest frame.
+ */
+struct aBuffer {
+    char *b; //pointer to our buffer in memory
+    int len;
+    int cap; //bytes allocated for b
+};
+
+#define ABUF_INIT {NULL, 0, 0} //acts as a constructor
+
+/**
+ * This function makes room for len more bytes.
+ * @return 0 if the memory could not be allocated
+ */
+int abReserve(struct aBuffer *ab, int len) {
+    if (ab->len + len <= ab->cap) return 1;
+    int cap = ab->cap ? ab->cap : 64;
+    while (cap < ab->len + len) cap *= 2;
+    char *new = realloc(ab->b, cap);
+    if (new == NULL) return 0;
+    ab->b = new;
+    ab->cap = cap;
+    return 1;
+}
+
+/**
+ * This function appends the string to an aBuffer buffer
+ * @param ab append buffer
+ * @param s string
+ * @param len of string
+ */
+void abAppend(struct aBuffer *ab, const char *s, int len) {
+    if (len <= 0 || !abReserve(ab, len)) return;
+    memcpy(&ab->b[ab->len], s, len); //copies the string after the end of current data in buffer
+    ab->len += len;
+}
+
+/**
+ * This function appends n copies of the character c, e.g. padding spaces.
+ */
+void abPad(struct aBuffer *ab, char c, int n) {
+    if (n <= 0 || !abReserve(ab, n)) return;
+    memset(&ab->b[ab->len], c, n);
+    ab->len += n;
+}
+
+/**
+ * This function deallocates the dynamic memory.
+ * @param ab append buffer
+ */
+void aBufferFree(struct aBuffer *ab) {
+    free(ab->b);
+    ab->b = NULL;
+    ab->len = 0;
+    ab->cap = 0;
+}
+
+struct aBuffer frameBuffer = ABUF_INIT; //the frame refreshScreen() builds, reused for every frame
+struct aBuffer lineBuffer = ABUF_INIT; //the screen line being drawn, swapped with its shadow line by emitLine()
+
+/*** hud ***/
+/**
+ * Returns a monotonic timestamp in nanoseconds.
+ */
+long long hudNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * This function ends the current phase: the time since the last mark is added to phase.
+ */
+void hudPhase(int phase) {
+    long long now = hudNow();
+    E.hud.frame[phase] += now - E.hud.mark;
+    E.hud.mark = now;
+}
+
+/**
+ * This function ends a frame. If keys were handled since the last frame, their timings become
+ * the timings of the last key, otherwise (e.g. a frame of the loader) they are dropped.
+ * @param written bytes written to the terminal
+ */
+void hudFrame(size_t written) {
+    struct hud *h = &E.hud;
+    if (written) hudPhase(HUD_WRITE);
+    if (h->keys) {
+        for (int p = 0; p < HUD_PHASES; p++) {
+            h->last[p] = h->frame[p];
+            h->samples[p][h->next] = h->frame[p];
+        }
+        h->next = (h->next + 1) % TECS_HUD_SAMPLES;
+        if (h->nsamples < TECS_HUD_SAMPLES) h->nsamples++;
+        h->framebytes = written;
+        h->keys = 0;
+    }
+    memset(h->frame, 0, sizeof(h->frame));
+}
+
+int hudCompare(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*** syntax highlighting ***/
+#define HL_NUMBERS 0x01 //the file type highlights numbers
+#define HL_STRINGS 0x02 //the file type highlights strings in double and single quotes
+
+enum highlight {
+    HL_NORMAL, HL_COMMENT, HL_KEYWORD1, HL_KEYWORD2, HL_STRING, HL_NUMBER
+};
+
+enum highlightState {
+    HL_CODE, HL_IN_COMMENT //the row ends inside a block comment
+};
+
+/**
+ * How a file type is highlighted. Keywords ending in '|' are types and get the second keyword colour.
+ */
+struct syntax {
+    const char *name;
+    const char **match; //file name endings of the file type
+    const char **keywords;
+    const char *comment; //start of a comment to the end of the line, NULL if there is none
+    const char *blockstart, *blockend; //block comment, NULL if there is none
+    int flags; //HL_ flags
+};
+
+const char *cMatch[] = {".c", ".h", ".cc", ".cpp", ".cxx", ".hpp", ".hh", NULL};
+const char *cKeywords[] = {
+        "switch", "if", "while", "for", "break", "continue", "return", "else", "struct", "union", "typedef",
+        "static", "enum", "class", "case", "default", "do", "goto", "sizeof", "const", "extern", "volatile",
+        "inline", "namespace", "template", "public", "private", "protected", "virtual", "new", "delete",
+        "#include", "#define", "#ifdef", "#ifndef", "#if", "#else", "#endif", "#elif",
+        "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|", "void|", "short|", "auto|",
+        "bool|", "size_t|", "ssize_t|", "off_t|", NULL};
+const char *pyMatch[] = {".py", NULL};
+const char *pyKeywords[] = {
+        "def", "class", "return", "if", "elif", "else", "for", "while", "break", "continue", "pass", "import",
+        "from", "as", "with", "try", "except", "finally", "raise", "yield", "lambda", "global", "nonlocal",
+        "in", "is", "not", "and", "or", "async", "await", "del", "assert",
+        "None|", "True|", "False|", "self|", NULL};
+const char *confMatch[] = {".sh", ".conf", ".cfg", ".ini", ".toml", ".yml", ".yaml", "Makefile", ".mk", NULL};
+const char *confKeywords[] = {
+        "if", "then", "else", "elif", "fi", "for", "while", "do", "done", "case", "esac", "function", "export",
+        "true|", "false|", "yes|", "no|", "on|", "off|", NULL};
+
+const struct syntax syntaxes[] = {
+        {"c", cMatch, cKeywords, "//", "/*", "*/", HL_NUMBERS | HL_STRINGS},
+        {"python", pyMatch, pyKeywords, "#", NULL, NULL, HL_NUMBERS | HL_STRINGS},
+        {"config", confMatch, confKeywords, "#", NULL, NULL, HL_NUMBERS | HL_STRINGS},
+};
+
+/**
+ * This function picks the syntax of the file type from the file name. All rows are highlighted again.
+ */
+void syntaxSelect() {
+    const struct syntax *syntax = NULL;
+    size_t len = E.filename ? strlen(E.filename) : 0;
+    for (size_t i = 0; i < sizeof(syntaxes) / sizeof(syntaxes[0]) && syntax == NULL; i++) {
+        for (const char **m = syntaxes[i].match; *m && syntax == NULL; m++) {
+            size_t mlen = strlen(*m);
+            if (mlen <= len && strcmp(E.filename + len - mlen, *m) == 0) syntax = &syntaxes[i];
+        }
+    }
+    if (syntax == E.syntax) return;
+    E.syntax = syntax;
+    rowIter it = {NULL, 0};
+    for (int j = 0; j < E.numrows; j++) rowIterAt(&it, j)->flags &= ~ROW_HL;
+    E.hlvalid = 0;
+}
+
+/**
+ * Returns 1 if c separates words, e.g. a keyword from what follows it.
+ */
+int syntaxSeparator(int c) {
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];{}:&|!^?", c) != NULL;
+}
+
+/**
+ * This function highlights len characters of a row which starts in state in.
+ * @param s the characters, render or chars of the row
+ * @param len
+ * @param hl gets the highlight of each character, NULL if only the state at the end is wanted
+ * @param in
+ * @return the state at the end of the row
+ */
+int syntaxLex(const char *s, int len, unsigned char *hl, int in) {
+    const struct syntax *syn = E.syntax;
+    int clen = syn->comment ? strlen(syn->comment) : 0;
+    int bslen = syn->blockstart ? strlen(syn->blockstart) : 0;
+    int belen = syn->blockend ? strlen(syn->blockend) : 0;
+    int incomment = in == HL_IN_COMMENT;
+    int quote = 0; //the quote of the string we are in
+    int separated = 1; //1 if the previous character separates words
+    int number = 0; //1 if the previous character belongs to a number
+    int i = 0;
+    while (i < len) {
+        char c = s[i];
+        int n = 1, type = HL_NORMAL;
+        if (incomment) {
+            type = HL_COMMENT;
+            if (belen && i + belen <= len && memcmp(&s[i], syn->blockend, belen) == 0) {
+                n = belen;
+                incomment = 0;
+            }
+        } else if (quote) {
+            type = HL_STRING;
+            if (c == '\\' && i + 1 < len) n = 2;
+            else if (c == quote) quote = 0;
+        } else if (clen && i + clen <= len && memcmp(&s[i], syn->comment, clen) == 0) {
+            if (hl) memset(&hl[i], HL_COMMENT, len - i);
+            break;
+        } else if (bslen && i + bslen <= len && memcmp(&s[i], syn->blockstart, bslen) == 0) {
+            type = HL_COMMENT;
+            n = bslen;
+            incomment = 1;
+        } else if ((syn->flags & HL_STRINGS) && (c == '"' || c == '\'')) {
+            type = HL_STRING;
+            quote = c;
+        } else if ((syn->flags & HL_NUMBERS) &&
+                   ((isdigit((unsigned char) c) && (separated || number)) || (c == '.' && number))) {
+            type = HL_NUMBER;
+        } else if (separated) {
+            for (const char **k = syn->keywords; *k; k++) {
+                if ((*k)[0] != c) continue;
+                int klen = strlen(*k);
+                int type2 = (*k)[klen - 1] == '|';
+                if (type2) klen--;
+                if (i + klen <= len && memcmp(&s[i], *k, klen) == 0 &&
+                    (i + klen == len || syntaxSeparator((unsigned char) s[i + klen]))) {
+                    type = type2 ? HL_KEYWORD2 : HL_KEYWORD1;
+                    n = klen;
+                    break;
+                }
+            }
+        }
+        if (hl) memset(&hl[i], type, n < len - i ? n : len - i);
+        number = type == HL_NUMBER;
+        separated = type == HL_KEYWORD1 || type == HL_KEYWORD2 ? 0 : syntaxSeparator((unsigned char) s[i + n - 1]);
+        if (type == HL_STRING || type == HL_COMMENT) separated = 1;
+        i += n;
+    }
+    return incomment ? HL_IN_COMMENT : HL_CODE;
+}
+
+/**
+ * This function highlights the row at y if it isn't highlighted for the state in already.
+ * @param y
+ * @param in state at the start of the row
+ * @param draw 1 if the row gets drawn and needs its hl, 0 if only the state at its end is wanted
+ * @return the state at the end of the row
+ */
+int syntaxRow(int y, int in, int draw) {
+    erow *row = rowAt(y);
+    int whole = draw && row->size <= TECS_LONG_LINE; //long rows are drawn from chars without colours
+    if ((row->flags & ROW_HL) && row->hlin == in && (row->hl || !whole)) return row->hlout;
+    if (whole) {
+        rowRender(row);
+        unsigned char *hl = realloc(row->hl, row->rsize + 1);
+        if (hl == NULL) quit("realloc");
+        row->hl = hl;
+        row->hlout = syntaxLex(row->render, row->rsize, hl, in);
+    } else {
+        free(row->hl); //it would be stale
+        row->hl = NULL;
+        row->hlout = syntaxLex(row->chars, row->size, NULL, in);
+    }
+    row->hlin = in;
+    row->flags |= ROW_HL;
+    return row->hlout;
+}
+
+/**
+ * This function makes the highlight of the rows from up to to right before they get drawn. Only the rows
+ * from the last edit on are looked at, and only as far as their state at the end changes, so a keystroke
+ * costs the same in a small and a huge file. When the state above the screen isn't known, highlighting
+ * starts TECS_HL_SYNC rows above the screen.
+ * @param from first row drawn
+ * @param to row after the last row drawn
+ */
+void syntaxPrepare(int from, int to) {
+    if (E.syntax == NULL) return;
+    if (to > E.numrows) to = E.numrows;
+    if (from >= to) return;
+    int k = from - 1 < E.hlvalid - 1 ? from - 1 : E.hlvalid - 1; //the last row known to be right
+    if (k < from - 1 - TECS_HL_SYNC) k = from - 1 - TECS_HL_SYNC;
+    int exact = k < E.hlvalid;
+    int in = HL_CODE;
+    if (k >= 0) {
+        erow *row = rowAt(k);
+        if (row->flags & ROW_HL) in = row->hlout;
+    }
+    for (int j = k + 1; j < to; j++) in = syntaxRow(j, in, j >= from);
+    if (exact && to > E.hlvalid) E.hlvalid = to;
+}
+
+/**
+ * Returns the SGR colour of a highlight.
+ */
+int syntaxColor(int hl) {
+    switch (hl) {
+        case HL_COMMENT:
+            return 36;
+        case HL_KEYWORD1:
+            return 33;
+        case HL_KEYWORD2:
+            return 32;
+        case HL_STRING:
+            return 35;
+        case HL_NUMBER:
+            return 31;
+        default:
+            return 39;
+    }
+}
+
+/*** output ***/
+/**
+ * This function checks if the users cursor has moved outside of the visible window
+ * and adjusts E.rowoff so that the cursor is just inside the visible window.
+ */
+
+void scroll() {
+    E.rx = 0;
+    if (E.cy < E.numrows) {
+        E.rx = cXToRx(rowAt(E.cy), E.cx);
+    }
+    if (E.cy < E.rowoff) { // checks if the cursor is above the visible window.
+        E.rowoff = E.cy;  // scrolls up to where the cursor is.
+    }
+    if (E.cy >= E.rowoff + E.screenrows) { //checks if the cursor is past the bottom of the visible window.
+        E.rowoff = E.cy - E.screenrows + 1;
+    }
+    if (E.rx < E.coloff) { // checks if the cursor is outside the visible window.
+        E.coloff = E.rx;
+    }
+    if (E.rx >= E.coloff + E.screencols - E.gutter) { //checks if the cursor is outside the visible window.
+        E.coloff = E.rx - (E.screencols - E.gutter) + 1;
+    }
+}
+
+/**
+ * This function works out the width of the line number gutter. The width only changes when the last line
+ * number gets another digit, so it is kept as long as the number of lines stays in its range.
+ */
+void gutterUpdate() {
+    if (!E.numbers) {
+        E.gutter = 0;
+        return;
+    }
+    long long last = E.numrows;
+    if (E.view.on) last = atomic_load(&E.view.lines) >= 0 ? atomic_load(&E.view.lines) :
+                          (E.view.firstline > 0 ? E.view.firstline : 0) + E.numrows;
+    if (E.gutter && last < E.gutterlimit && last >= E.gutterlimit / 10) return;
+    int digits = 1;
+    long long limit = 10;
+    while (last >= limit) {
+        digits++;
+        limit *= 10;
+    }
+    E.gutter = digits + 1 < E.screencols / 2 ? digits + 1 : 0; //no room for it on a narrow terminal
+    E.gutterlimit = limit;
+}
+
+/**
+ * This function drops the shadow frame, so the next refreshScreen() clears and repaints the whole terminal.
+ * Needed whenever the terminal contents are unknown, e.g. at startup or after a resize.
+ */
+void invalidateScreen() {
+    E.fullredraw = 1;
+}
+
+/**
+ * This function makes sure there is one shadow line for every line of the terminal.
+ * The shadow keeps what was last sent for each line, so unchanged lines are not sent again.
+ */
+void shadowResize() {
+    int lines = E.screenrows + 2 + E.hud.on; //text rows, status bar, message bar and the HUD
+    if (E.shadow && E.shadowlines == lines) return;
+    for (int y = 0; y < E.shadowlines; y++) aBufferFree(&E.shadow[y]);
+    free(E.shadow);
+    E.shadow = calloc(lines, sizeof(struct aBuffer));
+    if (E.shadow == NULL) quit("calloc");
+    E.shadowlines = lines;
+    E.fullredraw = 1;
+}
+
+/**
+ * Returns 1 if a line only contains printable ASCII, so every byte is one column on the screen.
+ */
+int isPlainLine(const char *s, int len) {
+    for (int j = 0; j < len; j++)
+        if ((unsigned char) s[j] < ' ' || (unsigned char) s[j] > '~') return 0;
+    return 1;
+}
+
+/**
+ * This function compares a freshly drawn line with the shadow of what the terminal shows and appends
+ * only the difference to the frame. For plain text lines just the changed span between the common
+ * prefix and suffix is sent, other lines (colours, emojis) are sent whole. The line becomes the new shadow.
+ * @param ab frame which gets written to the terminal
+ * @param y screen line, starting at 0
+ * @param line contents of the line. It becomes the shadow and gets the memory of the old shadow, emptied
+ */
+void emitLine(struct aBuffer *ab, int y, struct aBuffer *line) {
+    struct aBuffer *old = &E.shadow[y];
+    if (old->len == line->len && (line->len == 0 || memcmp(old->b, line->b, line->len) == 0)) {
+        line->len = 0; //unchanged, nothing to send
+        return;
+    }
+    int from = 0, to = line->len;
+    int plain = isPlainLine(old->b, old->len) && isPlainLine(line->b, line->len);
+    if (plain) {
+        int min = old->len < line->len ? old->len : line->len;
+        while (from < min && old->b[from] == line->b[from]) from++; //common prefix
+        if (old->len == line->len)
+            while (to > from && old->b[to - 1] == line->b[to - 1]) to--; //common suffix
+    }
+    char buf[32];
+    int buflen = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, from + 1);
+    abAppend(ab, buf, buflen);
+    if (!plain) abAppend(ab, "\x1b[K", 3); //we don't know the width of the old line, clear it first
+    abAppend(ab, line->b + from, to - from);
+    if (plain && line->len < old->len) abAppend(ab, "\x1b[K", 3); //clear what is left of the old line
+    struct aBuffer swap = *old;
+    *old = *line;
+    *line = swap;
+    line->len = 0;
+}
+
+/**
+ * This function reverses the order of n shadow lines.
+ */
+void shadowReverse(struct aBuffer *sh, int n) {
+    for (int i = 0, j = n - 1; i < j; i++, j--) {
+        struct aBuffer swap = sh[i];
+        sh[i] = sh[j];
+        sh[j] = swap;
+    }
+}
+
+/**
+ * This function moves the text area of the terminal when the view has been scrolled vertically by less
+ * than a screen. A scroll region (DECSTBM) over the text rows is scrolled with CSI S or CSI T and the
+ * shadow lines are moved the same way, so only the rows which scrolled into view get drawn.
+ * @param ab
+ */
+void scrollRegion(struct aBuffer *ab) {
+    int d = E.rowoff - E.shadowrowoff;
+    if (d == 0 || E.coloff != E.shadowcoloff || d >= E.screenrows || -d >= E.screenrows) return;
+    char buf[48];
+    int n = abs(d);
+    int buflen = snprintf(buf, sizeof(buf), "\x1b[m\x1b[1;%dr\x1b[%d%c\x1b[r", E.screenrows, n, d > 0 ? 'S' : 'T');
+    abAppend(ab, buf, buflen);
+    struct aBuffer *sh = E.shadow;
+    int keep = E.screenrows - n;
+    int first = d > 0 ? n : keep; //the lines are rotated, so the memory of the lines scrolled out is reused
+    shadowReverse(sh, first);
+    shadowReverse(sh + first, E.screenrows - first);
+    shadowReverse(sh, E.screenrows);
+    for (int j = 0; j < n; j++) sh[d > 0 ? keep + j : j].len = 0; //lines scrolled in are blank on the terminal
+}
+
+/**
+ * This function gives us useful information about the file like linenumber, if modified and helpful commands
+ * @param ab
+ */
+void setStatusBar(struct aBuffer *ab) {
+    struct aBuffer *line = &lineBuffer;
+    abAppend(line, "\x1b[7m", 4);
+    char status[80], rstatus[80];
+    int len;
+    if (E.view.on) {
+        long long lines = atomic_load(&E.view.lines);
+        off_t indexed = atomic_load(&E.view.indexed);
+        if (lines >= 0) len = snprintf(status, sizeof(status), "%.20s - %lld lines (view)", E.filename, lines);
+        else len = snprintf(status, sizeof(status), "%.20s - (view, indexing %d%%)", E.filename,
+                            (int) (indexed * 100 / (E.view.size ? E.view.size : 1)));
+    } else if (E.load.active)
+        len = snprintf(status, sizeof(status), "%.20s - %d lines (loading %d%%)",
+                       E.filename ? E.filename : "[No Name]", E.numrows,
+                       (int) (E.load.pos * 100 / E.mapsize));
+    else
+        len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+                       E.filename ? E.filename : "[No Name]", E.numrows,
+                       E.dirty ? "(modified)" : E.follow.on ? "(following)" : "");
+    int rlen;
+    if (E.search.active) rlen = searchStatus(rstatus, sizeof(rstatus));
+    else if (E.view.on) {
+        int pct = (int) (viewRowOffset(E.cy) * 100 / (E.view.size ? E.view.size : 1));
+        if (E.view.firstline >= 0) rlen = snprintf(rstatus, sizeof(rstatus), "%lld %d%%", E.view.firstline + E.cy + 1, pct);
+        else rlen = snprintf(rstatus, sizeof(rstatus), "%d%%", pct);
+    } else rlen = snprintf(rstatus, sizeof(rstatus), "%s%s%d/%d", E.syntax ? E.syntax->name : "",
+                         E.syntax ? " | " : "", E.cy + 1, E.numrows);
+    int cols; //the file name may have wide characters
+    len = utf8Fit(status, len, E.screencols, &cols);
+    abAppend(line, status, len);
+    if (E.screencols - cols >= rlen) { //right aligned if it fits
+        abPad(line, ' ', E.screencols - cols - rlen);
+        abAppend(line, rstatus, rlen);
+    } else {
+        abPad(line, ' ', E.screencols - cols);
+    }
+    abAppend(line, "\x1b[m", 3);
+    emitLine(ab, E.screenrows, line);
+}
+
+
+/**
+ * This function draws a message bar and then displays that in that bar
+ * @param ab
+ */
+void drawStatusBar(struct aBuffer *ab) {
+    int cols;
+    int msglen = utf8Fit(E.statusmsg, strlen(E.statusmsg), E.screencols, &cols);
+
+    abAppend(&lineBuffer, E.statusmsg, msglen);
+    emitLine(ab, E.screenrows + 1, &lineBuffer);
+}
+
+/**
+ * This function shows or hides the HUD. It takes a line of the screen.
+ */
+void hudToggle() {
+    E.hud.on = !E.hud.on;
+    E.screenrows += E.hud.on ? -1 : 1;
+    E.hud.nsamples = E.hud.next = E.hud.keys = 0;
+    memset(E.hud.frame, 0, sizeof(E.hud.frame));
+    memset(E.hud.last, 0, sizeof(E.hud.last));
+    invalidateScreen();
+    setStatusMessage(E.hud.on ? "HUD on: last key (p50/p99) in us, Ctrl-I twice hides it" : "HUD off");
+}
+
+/**
+ * This function draws the HUD line: for each phase the time of the last key and the p50/p99 of the
+ * recent keys in microseconds, the bytes of the last frame and the memory of the rows.
+ */
+void drawHud(struct aBuffer *ab) {
+    static const char *names[HUD_PHASES] = {"in", "ed", "sc", "bu", "wr"};
+    struct hud *h = &E.hud;
+    char buf[256];
+    long long total = 0;
+    for (int p = 0; p < HUD_PHASES; p++) total += h->last[p];
+    int len = snprintf(buf, sizeof(buf), "key %lld", total / 1000);
+    for (int p = 0; p < HUD_PHASES; p++) {
+        long long sorted[TECS_HUD_SAMPLES];
+        long long p50 = 0, p99 = 0;
+        if (h->nsamples) {
+            memcpy(sorted, h->samples[p], h->nsamples * sizeof(long long));
+            qsort(sorted, h->nsamples, sizeof(long long), hudCompare);
+            p50 = sorted[(h->nsamples - 1) / 2];
+            p99 = sorted[(h->nsamples - 1) * 99 / 100];
+        }
+        len += snprintf(buf + len, sizeof(buf) - len, " %s %lld (%lld/%lld)", names[p], h->last[p] / 1000,
+                        p50 / 1000, p99 / 1000);
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, " | %zuB | rows %.1fM text %.1f/%.1fM undo %.1fM",
+                    h->framebytes, E.numrows * (double) sizeof(erow) / 1e6,
+                    (E.text.usedbytes + E.text.largebytes) / 1e6, (E.text.arenabytes + E.text.largebytes) / 1e6,
+                    E.undo.bytes / 1e6);
+    if (len > E.screencols) len = E.screencols;
+    abAppend(&lineBuffer, buf, len);
+    emitLine(ab, E.screenrows + 2, &lineBuffer);
+}
+
+/**
+ * This function draws the visible columns of a long row straight from its chars. The column index finds
+ * the first visible character, so the cost depends on the screen width and not on the length of the row.
+ * A wide character cut by the left edge of the screen is drawn as spaces, one cut by the right edge not at all.
+ * @param line
+ * @param row
+ */
+void drawSlice(struct aBuffer *line, erow *row) {
+    static const char spaces[TECS_TAB_STOP] = "        ";
+    int end = E.coloff + E.screencols - E.gutter;
+    int cx = rXToCx(row, E.coloff);
+    int rx = cXToRx(row, cx);
+    while (cx < row->size && rx < end) {
+        if (row->chars[cx] == '\t') {
+            int next = rx + TECS_TAB_STOP - rx % TECS_TAB_STOP;
+            int from = rx > E.coloff ? rx : E.coloff; //the tab may start left of the screen
+            abAppend(line, spaces, (next < end ? next : end) - from);
+            rx = next;
+            cx++;
+        } else if ((unsigned char) row->chars[cx] >= 0x80) {
+            int width;
+            int n = utf8Decode(&row->chars[cx], row->size - cx, &width);
+            if (rx + width > end) break;
+            if (rx < E.coloff) abPad(line, ' ', rx + width - E.coloff);
+            else abAppend(line, &row->chars[cx], n);
+            cx += n;
+            rx += width;
+        } else { //copy everything up to the next tab or non-ASCII character at once
+            int n = row->size - cx < end - rx ? row->size - cx : end - rx;
+            const char *stop = columnStop(&row->chars[cx], n);
+            if (stop) n = stop - &row->chars[cx];
+            abAppend(line, &row->chars[cx], n);
+            cx += n;
+            rx += n;
+        }
+    }
+}
+
+/**
+ * This function finds the bytes of the render of a row with non-ASCII characters which are drawn in
+ * cols columns from E.coloff on.
+ * @param row
+ * @param cols
+ * @param start gets the index of the first byte drawn
+ * @param lead gets the number of spaces drawn in front of it, for a wide character cut by the left edge
+ * @return the index behind the last byte drawn
+ */
+int renderSlice(erow *row, int cols, int *start, int *lead) {
+    int j = 0, rx = 0, width = 1, n = 0;
+    while (j < row->rsize) {
+        n = utf8Decode(&row->render[j], row->rsize - j, &width);
+        if (rx + width > E.coloff) break;
+        rx += width;
+        j += n;
+    }
+    *lead = 0;
+    if (j < row->rsize && rx < E.coloff) {
+        *lead = rx + width - E.coloff < cols ? rx + width - E.coloff : cols;
+        j += n;
+    }
+    *start = j;
+    int used;
+    return j + utf8Fit(&row->render[j], row->rsize - j, cols - *lead, &used);
+}
+
+/**
+ * This function draws the visible render bytes from start to end of a highlighted row, switching the
+ * colour where the highlight changes.
+ * @param line
+ * @param row
+ * @param start
+ * @param end
+ */
+void drawHighlighted(struct aBuffer *line, erow *row, int start, int end) {
+    int color = HL_NORMAL;
+    int j = start;
+    while (j < end) {
+        int run = j;
+        while (run < end && row->hl[run] == row->hl[j]) run++;
+        if (row->hl[j] != color) {
+            char buf[16];
+            color = row->hl[j];
+            abAppend(line, buf, snprintf(buf, sizeof(buf), "\x1b[%dm", syntaxColor(color)));
+        }
+        abAppend(line, &row->render[j], run - j);
+        j = run;
+    }
+    if (color != HL_NORMAL) abAppend(line, "\x1b[39m", 5);
+}
+
+/**
+ * This function draws one line of the text area into line, without clearing the rest of the line.
+ * @param line
+ * @param y screen line
+ */
+void drawRow(struct aBuffer *line, int y) {
+    int filerow = y + E.rowoff;
+    if (filerow >= E.numrows) {
+        if (E.numrows == 0 && y == E.screenrows / 3) {
+            char welcome[80];
+            int welcomelen = snprintf(welcome, sizeof(welcome),
+                                      "\U0001F4DD \x1b[7m TeCS -- version %s", TECS_VERSION);
+            int cols;
+            welcomelen = utf8Fit(welcome, welcomelen, E.screencols, &cols);
+            int padding = (E.screencols - cols) / 2;
+            abPad(line, ' ', padding);
+            abAppend(line, welcome, welcomelen);
+        } else {
+            abAppend(line, " ", 1);
+        }
+    } else {
+        if (E.gutter) {
+            char num[24];
+            long long first = E.view.on ? E.view.firstline : 0; //-1 while a view doesn't know it
+            int len = first < 0 ? 0 : snprintf(num, sizeof(num), "%*lld ", E.gutter - 1, first + filerow + 1);
+            abPad(line, ' ', E.gutter - len);
+            abAppend(line, num, len);
+        }
+        erow *row = rowAt(filerow);
+        if (row->size > TECS_LONG_LINE) {
+            drawSlice(line, row);
+            return;
+        }
+        rowRender(row);
+        int start = E.coloff < row->rsize ? E.coloff : row->rsize, end, lead = 0;
+        if (row->flags & ROW_UTF8) {
+            end = renderSlice(row, E.screencols - E.gutter, &start, &lead);
+            abPad(line, ' ', lead);
+        } else {
+            end = start + E.screencols - E.gutter < row->rsize ? start + E.screencols - E.gutter : row->rsize;
+        }
+        if (E.syntax && row->hl && (row->flags & ROW_HL)) {
+            drawHighlighted(line, row, start, end);
+            return;
+        }
+        abAppend(line, &row->render[start], end - start);
+    }
+}
+
+/**
+ * This functions setups the field in which the character inout will be handled.
+ * Only lines which differ from what the terminal already shows are sent.
+ */
+void drawField(struct aBuffer *ab) {
+    int y;
+    syntaxPrepare(E.rowoff, E.rowoff + E.screenrows);
+    for (y = 0; y < E.screenrows; y++) {
+        drawRow(&lineBuffer, y);
+        emitLine(ab, y, &lineBuffer);
+    }
+}
+
+/**
+ * This function refreshed the window after each keypress.
+ * Nothing is written when neither the screen contents nor the cursor changed.
+ */
+void refreshScreen() {
+    long long t = traceBegin();
+    if (E.view.on) viewSlide();
+    if (E.hud.on) E.hud.mark = hudNow();
+    gutterUpdate();
+    scroll();
+    if (E.hud.on) hudPhase(HUD_SCROLL);
+    shadowResize();
+    struct aBuffer *ab = &frameBuffer;
+    ab->len = 0;
+
+    abAppend(ab, "\x1b[?25l", 6); //hide cursor
+    int hidden = ab->len;
+    if (E.fullredraw) {
+        for (int y = 0; y < E.shadowlines; y++) E.shadow[y].len = 0;
+        abAppend(ab, "\x1b[m\x1b[2J", 7); //the terminal is empty now and so is the shadow
+        E.fullredraw = 0;
+    } else {
+        scrollRegion(ab);
+    }
+    E.shadowrowoff = E.rowoff;
+    E.shadowcoloff = E.coloff;
+    drawField(ab);
+    setStatusBar(ab);
+    drawStatusBar(ab);
+    if (E.hud.on) drawHud(ab);
+
+    int cursory = (E.cy - E.rowoff) + 1;
+    int cursorx = (E.rx - E.coloff) + 1 + E.gutter;
+    if (ab->len == hidden && cursory == E.shadowcy && cursorx == E.shadowcx) { //nothing changed
+        if (E.hud.on) hudFrame(0);
+        traceEnd("refreshScreen", t);
+        return;
+    }
+    E.shadowcy = cursory;
+    E.shadowcx = cursorx;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cursory,
+             cursorx); //To position the cursor on the screen, we have to subtract E.rowoff from E.cy. Same with E.rx. for horizontal scrolling.
+
+    abAppend(ab, buf, strlen(buf));
+
+    abAppend(ab, "\x1b[?25h", 6); //shows cursor l hides cursor
+
+    if (E.hud.on) hudPhase(HUD_BUILD);
+    write(STDOUT_FILENO, ab->b, ab->len); //all changes reach the terminal at once
+    if (E.hud.on) hudFrame(ab->len);
+    traceEnd("refreshScreen", t);
+}
+
+/**
+ * This function takes a format string and number of arguments
+ * @param fmt
+ * @param ... allows to take any number of arguments
+ */
+void setStatusMessage(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap); //status message with number of seconds
+    va_end(ap);
+    E.statusmsg_time = time(NULL);
+    timerStart(TIMER_STATUS, TECS_STATUS_TIMEOUT, infoBar); //the info bar returns when the message expires
+}
+
+/**
+ * This function shows the information bar with the keys and the current time. It stays until
+ * another message replaces it.
+ */
+void infoBar() {
+    time(&raw_time);
+    info = localtime(&raw_time);
+
+    char *s = concat("\U00002139: Ctrl-S   \U0001F4BE |Ctrl-Q   \U0001F6AB | Ctrl-F  \U0001F50D | \U000023F1 ",
+                     asctime(info));
+    setStatusMessage("%s", s);
+    free(s);
+    timerStop(TIMER_STATUS);
+}
+
+/*** events ***/
+/**
+ * This function arms timer id, fire is called by the event loop in ms milliseconds.
+ * @param id one of enum timers
+ * @param ms
+ * @param fire
+ */
+void timerStart(int id, int ms, void (*fire)()) {
+    E.timers[id].due = monotonicMs() + ms;
+    E.timers[id].fire = fire;
+}
+
+/**
+ * This function disarms timer id.
+ */
+void timerStop(int id) {
+    E.timers[id].due = 0;
+}
+
+/**
+ * Returns the milliseconds until the next timer is due, -1 if no timer is armed.
+ */
+int timerNext() {
+    long long next = -1, now = monotonicMs();
+    for (int i = 0; i < TIMERS; i++) {
+        if (E.timers[i].due == 0) continue;
+        long long wait = E.timers[i].due > now ? E.timers[i].due - now : 0;
+        if (next == -1 || wait < next) next = wait;
+    }
+    return next;
+}
+
+/**
+ * This function calls the timers which are due.
+ * @return the number of timers called
+ */
+int timerRun() {
+    int fired = 0;
+    long long now = monotonicMs();
+    for (int i = 0; i < TIMERS; i++) {
+        if (E.timers[i].due == 0 || E.timers[i].due > now) continue;
+        E.timers[i].due = 0; //fire may arm it again
+        E.timers[i].fire();
+        fired++;
+    }
+    return fired;
+}
+
+/**
+ * SIGWINCH handler. It only wakes up the event loop, which does the work.
+ */
+void windowChanged(int sig) {
+    (void) sig;
+    int saved = errno;
+    write(E.sigpipe[1], "", 1);
+    errno = saved;
+}
+
+/**
+ * This function takes over the new size of the terminal after a SIGWINCH and repaints everything.
+ */
+void windowResize() {
+    char buf[64];
+    while (read(E.sigpipe[0], buf, sizeof(buf)) > 0); //several signals are handled at once
+    int rows, cols;
+    if (windowSize(&rows, &cols) == -1) return;
+    E.screenrows = rows - 2 - E.hud.on; //status bar, message bar and the HUD
+    if (E.screenrows < 1) E.screenrows = 1;
+    E.screencols = cols;
+    invalidateScreen();
+}
+
+/**
+ * This function sets up the self-pipe and the SIGWINCH handler of the event loop.
+ */
+void eventsInit() {
+    if (pipe2(E.sigpipe, O_NONBLOCK | O_CLOEXEC) == -1) quit("pipe");
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = windowChanged;
+    sa.sa_flags = SA_RESTART; //read() of a key is not interrupted
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) quit("sigaction");
+}
+
+/*** input ***/
+/**
+ * This function displays a prompt in the status bar, and lets the user input a line of text after the prompt.
+ * @param prompt
+ * @param callback
+ * @return
+ */
+char *inputFileName(char *prompt, void (*callback)(char *, int)) {
+    return inputPrompt(prompt, callback, 0);
+}
+
+/**
+ * This function is inputFileName() for answers which may be empty, e.g. the text a replacement deletes with.
+ * @param prompt
+ * @param callback
+ * @param empty 1 if Enter accepts an empty line
+ * @return the input, NULL if the prompt was cancelled
+ */
+char *inputPrompt(char *prompt, void (*callback)(char *, int), int empty) {
+    size_t bufsize = 128;
+    char *buf = malloc(bufsize); //input is stored in buf which is dynamically allocated
+    size_t buflen = 0;
+    buf[0] = '\0';
+    while (1) { //infinite loop
+        setStatusMessage(prompt, buf); //sets status message
+        timerStop(TIMER_STATUS); //the prompt stays until it is answered
+        if (!inputPending()) refreshScreen(); //refresh screen once all typed keys are handled
+        int c = readKeypress(); //waits for keypress
+        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) { //allows the user press backspace in the prompt
+            if (buflen != 0) buflen = utf8Start(buf, buflen, buflen - 1); //the whole last character
+            buf[buflen] = '\0';
+        } else if (c == '\x1b') { //if escape is pressed
+            setStatusMessage("");
+            if (callback) callback(buf, c);
+            free(buf); //free the buf
+            return NULL; //return null
+        } else if (c == '\r') { //when enter pressed
+            if (buflen != 0 || empty) { //not empty
+                setStatusMessage(""); //status message cleared
+                if (callback) callback(buf, c); //if we dont want to use callpack we can just pass null
+                return buf; //input returned
+            }
+        } else if (!iscntrl(c) && c <
+                                  128) { //if printable char is entered and also test if char has value less than 128 to check if special char
+            if (buflen == bufsize - 1) { //if buflen reached maximum capacity
+                bufsize *= 2;
+                buf = realloc(buf, bufsize); //allocate the amount of memory before appending to buf
+            }
+            buf[buflen++] = c; //append to buf
+            buf[buflen] = '\0'; //signify end
+        } else if (c == PASTE) { //pasted text goes into the prompt without line breaks
+            for (int j = 0; j < E.pastelen; j++) {
+                if (iscntrl((unsigned char) E.paste[j])) continue;
+                if (buflen == bufsize - 1) {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = E.paste[j];
+            }
+            buf[buflen] = '\0';
+        }
+        if (callback) callback(buf, c);
+    }
+}
+
+/**
+ * Handles the the cursor position
+ * @param key pressed
+ */
+void moveCursor(int key) {
+    erow *row = rowAt(E.cy); //checks if the cursor is on actual line, NULL if not
+
+    switch (key) {
+        case ARROW_LEFT:
+            if (E.cx != 0) {
+                E.cx = utf8Start(row->chars, row->size, E.cx - 1);
+            } else if (E.cy > 0) { // allows to press <- at beginning of new line to come to previous line's end.
+                E.cy--;
+                E.cx = rowAt(E.cy)->size;
+            }
+            break;
+        case ARROW_RIGHT:
+            if (row && E.cx < row->size) {
+                int width;
+                E.cx += utf8Decode(&row->chars[E.cx], row->size - E.cx, &width);
+            } else if (row && E.cx ==
+                              row->size) { //opposite of <-. This allows user to press -> at the end of a line and appear then at the beginning of next line
+                E.cy++;
+                E.cx = 0;
+            }
+            break;
+        case ARROW_UP:
+            if (E.cy != 0) {
+                E.cy--;
+            }
+            break;
+        case ARROW_DOWN:
+            if (E.cy < E.numrows) {
+                E.cy++;
+            }
+            break;
+    }
+
+    row = rowAt(E.cy);
+    int rowlen = row ? row->size : 0;
+    if (E.cx > rowlen) { //if cx is to the right of the end of that line
+        E.cx = rowlen; //set cx as end of that line
+    } else if (E.cx < rowlen) { //not inside of a character
+        E.cx = utf8Start(row->chars, row->size, E.cx);
+    }
+}
+
+/**
+ * This function converts our array of erow structs into a single string, so that its ready
+ * to be written out to a file.
+ * @param buflen saves the lenght of text
+ * @return buf
+ */
+char *rowToString(int *buflen) {
+    int totlen = 0;
+    int j;
+    for (j = 0; j < E.numrows; j++)
+        totlen += rowAt(j)->size +
+                  1; //adds up the lengths of each row of text and adding 1 to each one for the newline character we’ll add to the end of each line
+    *buflen = totlen; //save the total length into buflen, to tell the caller how long the string is
+    char *buf = malloc(totlen); //allocating required memory
+    char *p = buf;
+    for (j = 0; j < E.numrows; j++) { //loop through the rows
+        erow *row = rowAt(j);
+        memcpy(p, row->chars, row->size); //copy the contents of each row to the end of the buffer
+        p += row->size;
+        *p = '\n'; //appending a new line character after each row
+        p++;
+    }
+    return buf;
+}
+
+/**
+ * This function maps a regular file into memory and starts the loader which creates one mapped row per line.
+ * No line is copied or rendered here.
+ * @param fd opened file
+ * @return 0 on success, -1 if the file can't be mapped
+ */
+int mapFile(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) return -1;
+    if (st.st_size == 0) return 0; //empty file, nothing to map
+    char *map;
+    if (E.follow.on) { //a followed file may get truncated, rows mapped from it would fault then
+        map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) return -1;
+        for (off_t got = 0, n; got < st.st_size; got += n) {
+            n = pread(fd, map + got, st.st_size - got, got);
+            if (n <= 0) {
+                munmap(map, st.st_size);
+                return -1;
+            }
+        }
+    } else {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) return -1;
+        E.mapdev = st.st_dev;
+        E.mapino = st.st_ino;
+    }
+    E.map = map;
+    E.mapsize = st.st_size;
+    loaderStart();
+    return 0;
+}
+
+/**
+ * This function replays the autosave journal of the file just read, if there is one.
+ */
+void readJournal() {
+    int changes = autosaveRecover();
+    if (changes) setStatusMessage("Recovered %d unsaved changes, Ctrl-S saves them", changes);
+}
+
+/**
+ * This method opens and reads a file from the disk. It takes the filename and opens the file.
+ * Regular files are memory mapped, anything else is read line by line.
+ * @param filename file which will be opened and read.
+ */
+void readFile(char *filename) {
+    free(E.filename);
+    E.filename = strdup(filename);
+    syntaxSelect();
+    if (E.view.on && viewOpen(filename) == 0) return; //only the part on the screen is read
+    E.view.on = 0;
+    long long t = traceBegin();
+    FILE *fp = fopen(filename, "r"); //opens the file
+    if (!fp) quit("fopen");
+    if (mapFile(fileno(fp)) == 0) {
+        fclose(fp);
+        E.dirty = 0;
+        readJournal();
+        traceEnd("readFile", t);
+        return;
+    }
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    E.autosave.replaying = 1; //the rows are the file, not changes to it
+    while ((linelen = getline(&line, &linecap, fp)) != -1) { //allows to read an entire file into the row store
+        while (linelen > 0 && (line[linelen - 1] == '\n' ||
+                               line[linelen - 1] == '\r'))
+            linelen--;
+        insertRow(E.numrows, line, linelen);
+    }
+    E.autosave.replaying = 0;
+    free(line); //freeing from allocation
+    fclose(fp);
+    E.dirty = 0;
+    readJournal();
+    traceEnd("readFile", t);
+}
+
+/**
+ * This function writes all buffers of iov to fd. writev() may write less than asked for,
+ * in that case the rest is written with further calls.
+ * @return 0 on success, -1 on error
+ */
+int writeAll(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t) n >= iov->iov_len) { //skip the buffers which are done
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function writes all rows to fd. The rows are streamed with writev() in batches, no copy of the
+ * text is made.
+ * @return number of bytes written, -1 on error (errno is set)
+ */
+long long writeRowsTo(int fd) {
+    static struct iovec iov[TECS_SAVE_BATCH * 2];
+    long long total = 0;
+    int cnt = 0;
+    for (int j = 0; j < E.numrows; j++) {
+        erow *row = rowAt(j);
+        iov[cnt].iov_base = row->chars;
+        iov[cnt++].iov_len = row->size;
+        iov[cnt].iov_base = "\n";
+        iov[cnt++].iov_len = 1;
+        total += row->size + 1;
+        if (cnt == TECS_SAVE_BATCH * 2 || j == E.numrows - 1) {
+            if (writeAll(fd, iov, cnt) == -1) return -1;
+            cnt = 0;
+        }
+    }
+    return total;
+}
+
+/**
+ * This function turns the mapping of the opened file into anonymous memory at the same address, so
+ * the rows which point into it stay valid while the file is overwritten. The text is read from fd,
+ * which still has its old contents.
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int mapDetach(int fd) {
+    char *copy = mmap(NULL, E.mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == MAP_FAILED) return -1;
+    for (size_t got = 0; got < E.mapsize;) {
+        ssize_t n = pread(fd, copy + got, E.mapsize - got, got);
+        if (n <= 0) {
+            munmap(copy, E.mapsize);
+            if (n == 0) errno = EIO; //the file got shorter
+            return -1;
+        }
+        got += n;
+    }
+    searchJobCancel(); //the search thread reads the rows
+    if (mmap(E.map, E.mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) ==
+        MAP_FAILED)
+        quit("mmap"); //the old mapping may be gone already, the rows can't be trusted anymore
+    memcpy(E.map, copy, E.mapsize);
+    munmap(copy, E.mapsize);
+    E.mapino = 0;
+    return 0;
+}
+
+/**
+ * This function saves a file which has more than one hard link. A rename would give path a new
+ * inode and leave the other names with the old text, so the file is overwritten in place. Unlike
+ * a rename this is not atomic, a crash while writing leaves a partly written file.
+ * @param path
+ * @param st status of the file at path
+ * @return number of bytes written, -1 on error (errno is set)
+ */
+long long writeRowsInPlace(const char *path, const struct stat *st) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1) return -1;
+    long long total = -1;
+    if (E.map == NULL || E.mapino != st->st_ino || E.mapdev != st->st_dev || mapDetach(fd) == 0)
+        total = writeRowsTo(fd);
+    if (total != -1 && ftruncate(fd, total) == -1) total = -1;
+    if (total != -1 && TECS_SAVE_FSYNC && fsync(fd) == -1) total = -1;
+    if (close(fd) == -1) total = -1;
+    return total;
+}
+
+/**
+ * This function writes all rows to a temporary file next to path and then renames it over path,
+ * so path always contains either the old or the complete new text. The original file is only
+ * replaced, never modified, so rows which still point into its mapping stay valid. The new file
+ * gets the permissions, the owner and the group of the original, as far as the user may set them.
+ * A file with more than one hard link is overwritten in place instead, see writeRowsInPlace().
+ * @param path
+ * @return number of bytes written, -1 on error (errno is set)
+ */
+long long writeRows(const char *path) {
+    struct stat st;
+    int exists = stat(path, &st) == 0;
+    if (exists && st.st_nlink > 1) return writeRowsInPlace(path, &st);
+    const char *slash = strrchr(path, '/');
+    int dirlen = slash ? slash - path + 1 : 0;
+    char *tmp = malloc(strlen(path) + 16);
+    if (tmp == NULL) return -1;
+    sprintf(tmp, "%.*s.%s.XXXXXX", dirlen, path, path + dirlen); //hidden file in the same directory
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+        free(tmp);
+        return -1;
+    }
+    mode_t mode;
+    if (exists) {
+        mode = st.st_mode & 07777; //keep the permissions of the original
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0644 & ~mask; //0644 is standard permission for text files.
+    }
+    int err = 0;
+    if (exists && fchown(fd, st.st_uid, st.st_gid) == -1 && errno != EPERM) //before fchmod, it clears set-id bits
+        err = -1; //only root may give the file away, an unprivileged save keeps its own owner
+    if (err != -1) err = fchmod(fd, mode);
+    long long total = err != -1 ? writeRowsTo(fd) : -1;
+    if (total == -1) err = -1;
+    if (err != -1 && TECS_SAVE_FSYNC) err = fsync(fd); //the data must be on disk before the rename
+    if (close(fd) == -1) err = -1;
+    if (err != -1) err = rename(tmp, path);
+    if (err == -1) {
+        int saved = errno;
+        unlink(tmp);
+        free(tmp);
+        errno = saved;
+        return -1;
+    }
+    if (TECS_SAVE_FSYNC) { //make the rename itself durable
+        char *dir = dirlen ? strndup(path, dirlen) : strdup(".");
+        int dfd = dir ? open(dir, O_RDONLY) : -1;
+        if (dfd != -1) {
+            fsync(dfd);
+            close(dfd);
+        }
+        free(dir);
+    }
+    free(tmp);
+    return total;
+}
+
+/**
+ * This function writes the rows to disk, asking for a filename if the file is new.
+ */
+void saveFile() {
+    if (E.filename == NULL) { //if its a new file
+        E.filename = inputFileName("Save as: %s (ESC to cancel)", NULL);
+        if (E.filename == NULL) { //if save is cancelled
+            infoBar();
+            return;
+        }
+        syntaxSelect();
+    }
+
+    long long t = traceBegin();
+    loaderFinish(); //all rows must exist before they are written
+    char *target = realpath(E.filename, NULL); //save through symbolic links, NULL if the file is new
+    long long len = writeRows(target ? target : E.filename);
+    free(target);
+    traceEnd("saveFile", t);
+    if (len != -1) {
+        E.dirty = 0;
+        autosaveSaved();
+        followSaved(len);
+        setStatusMessage("%lld bytes written to disk", len); //notifies user if save succeeded
+        return;
+    }
+    setStatusMessage("Can't save! I/O error: %s", strerror(errno)); //notifies user if save didnt succeed.
+}
+
+/*** search engine ***/
+/**
+ * A compiled search query. Matching works on raw bytes, so NUL bytes and mapped rows are fine.
  */
-struct aBuffer {
-    char *b; //pointer to our buffer in memory
+typedef struct searchPattern {
+    const unsigned char *needle;
     int len;
-};
+    int icase; //1 to ignore the case of ASCII letters
+    int skip[256]; //Boyer-Moore-Horspool shift for the byte under the last needle position
+    struct regex *re; //compiled regular expression, NULL for a literal search
+} searchPattern;
 
-#define ABUF_INIT {NULL, 0} //acts as a constructor
+/**
+ * Returns c in lower case if c is an ASCII letter and icase is set.
+ */
+unsigned char searchFold(unsigned char c, int icase) {
+    return icase && c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
 
 /**
- * This function appends the string to an aBuffer buffer
- * @param ab append buffer
- * @param s string
- * @param len of string
+ * This function prepares a query for searchFind().
+ * @param p
+ * @param needle the query, it must stay valid while p is used
+ * @param len
+ * @param icase 1 for a case insensitive search
  */
-void abAppend(struct aBuffer *ab, const char *s, int len) {
-    char *new = realloc(ab->b, ab->len +
-                               len); //alloc enough memory for the string. Current size of string + size of appending string
-    if (new == NULL) return;
-    memcpy(&new[ab->len], s, len); //copies the string after the end of current data in buffer
-    ab->b = new;
-    ab->len += len;
+void searchCompile(searchPattern *p, const char *needle, int len, int icase) {
+    p->needle = (const unsigned char *) needle;
+    p->len = len;
+    p->icase = icase;
+    p->re = NULL;
+    for (int c = 0; c < 256; c++) p->skip[c] = len;
+    for (int j = 0; j < len - 1; j++) {
+        unsigned char c = searchFold(p->needle[j], icase);
+        p->skip[c] = len - 1 - j;
+        if (icase && c >= 'a' && c <= 'z') p->skip[c - ('a' - 'A')] = len - 1 - j;
+    }
 }
 
 /**
- * This function deallocates the dynamic memory.
- * @param ab append buffer
+ * Returns 1 if the n bytes at s equal the n bytes of the needle at t.
  */
-void aBufferFree(struct aBuffer *ab) {
-    free(ab->b);
+int searchEqual(const searchPattern *p, const unsigned char *s, const unsigned char *t, int n) {
+    if (!p->icase) return memcmp(s, t, n) == 0;
+    for (int j = 0; j < n; j++)
+        if (searchFold(s[j], 1) != searchFold(t[j], 1)) return 0;
+    return 1;
 }
 
-/*** output ***/
 /**
- * This function checks if the users cursor has moved outside of the visible window
- * and adjusts E.rowoff so that the cursor is just inside the visible window.
+ * Boyer-Moore-Horspool search of the pattern in hay, starting at offset from.
  */
+const char *searchHorspool(const searchPattern *p, const unsigned char *hay, size_t n, size_t from) {
+    size_t len = p->len;
+    unsigned char last = searchFold(p->needle[len - 1], p->icase);
+    for (size_t i = from; i + len <= n; i += p->skip[hay[i + len - 1]]) {
+        if (searchFold(hay[i + len - 1], p->icase) == last && searchEqual(p, &hay[i], p->needle, len - 1))
+            return (const char *) &hay[i];
+    }
+    return NULL;
+}
 
-void scroll() {
-    E.rx = 0;
-    if (E.cy < E.numrows) {
-        E.rx = cXToRx(&E.row[E.cy], E.cx);
+/**
+ * This function returns the first occurrence of the pattern in the n bytes of hay, or NULL.
+ * With SSE2 16 positions are tested at once: a position is only a candidate if its byte equals the first
+ * byte of the needle and the byte len - 1 further equals the last byte, which filters out nearly
+ * everything before a single byte has to be compared. The rest of hay is searched with Horspool.
+ * @param p
+ * @param hay
+ * @param n
+ * @return pointer to the match
+ */
+const char *searchFind(const searchPattern *p, const char *hay, size_t n) {
+    const unsigned char *h = (const unsigned char *) hay;
+    size_t len = p->len;
+    if (len == 0) return hay;
+    if (n < len) return NULL;
+    size_t i = 0;
+#ifdef __SSE2__
+    unsigned char first = searchFold(p->needle[0], p->icase);
+    unsigned char last = searchFold(p->needle[len - 1], p->icase);
+    const __m128i f1 = _mm_set1_epi8((char) first);
+    const __m128i f2 = _mm_set1_epi8((char) (p->icase && first >= 'a' && first <= 'z' ? first - 32 : first));
+    const __m128i l1 = _mm_set1_epi8((char) last);
+    const __m128i l2 = _mm_set1_epi8((char) (p->icase && last >= 'a' && last <= 'z' ? last - 32 : last));
+    for (; i + 16 <= n - len + 1; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (h + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (h + i + len - 1));
+        __m128i eq = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(a, f1), _mm_cmpeq_epi8(a, f2)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(b, l1), _mm_cmpeq_epi8(b, l2)));
+        unsigned mask = _mm_movemask_epi8(eq);
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (len <= 2 || searchEqual(p, h + i + bit + 1, p->needle + 1, len - 2))
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
     }
-    if (E.cy < E.rowoff) { // checks if the cursor is above the visible window.
-        E.rowoff = E.cy;  // scrolls up to where the cursor is.
+#endif
+    return searchHorspool(p, h, n, i);
+}
+
+/*** regular expressions ***/
+/*
+ * Regular expressions for the search prompt: | ( ) * + ? {m,n} . [...] ^ $ and the escapes \d \w \s \D \W \S.
+ * The pattern is compiled to an NFA of the reversed expression, which is turned into a DFA lazily while
+ * rows are searched. Reading a row backwards from its end, the DFA is in an accepting state exactly at the
+ * positions where a match starts, so one pass over the row finds every match in linear time.
+ */
+#define REGEX_STATES 1024 //DFA states kept before the cache is flushed
+#define REGEX_NFA_MAX 20000 //maximum number of NFA states of a pattern
+#define REGEX_PREFIX 64 //maximum length of the literal prefix
+
+enum regexNodeType {
+    REGEX_EMPTY, REGEX_CLASS, REGEX_CAT, REGEX_ALT, REGEX_REPEAT, REGEX_BOL, REGEX_EOL
+};
+
+/**
+ * Node of a parsed pattern.
+ */
+typedef struct regexNode {
+    int type;
+    struct regexNode *a, *b;
+    int min, max; //REGEX_REPEAT, max is -1 if there is no limit
+    unsigned char set[32]; //REGEX_CLASS, bit c is set if the class contains the byte c
+} regexNode;
+
+enum nfaType {
+    NFA_CHAR, NFA_SPLIT, NFA_BOL, NFA_EOL, NFA_MATCH
+};
+
+typedef struct nfaState {
+    int type;
+    int out, out1;
+    const unsigned char *set; //NFA_CHAR
+} nfaState;
+
+/**
+ * A DFA state is a sorted set of NFA states.
+ */
+typedef struct dfaState {
+    int *set;
+    int nset;
+    int acceptbol; //1 if a match starts at the beginning of the row, -1 until known
+} dfaState;
+
+typedef struct regex {
+    regexNode *nodes;
+    int nnodes, nodecap;
+    nfaState *nfa;
+    int nnfa, nfacap;
+    int start; //NFA state where the reversed scan starts
+    dfaState **states;
+    int nstates;
+    int *next; //following DFA state of state s for the byte c at next[s * 256 + c], -1 until known
+    char *accept; //accept[s] is 1 if a match starts at the position state s is reached at
+    int *hash; //open addressing table of DFA state indexes
+    int dfastart; //DFA state at the end of a row, -1 until known
+    int flushes; //number of times the DFA states were dropped
+    int *mark, markgen; //marks NFA states which are already in a set
+    int *stack, *tmp;
+    char prefix[REGEX_PREFIX]; //every match starts with this literal
+    searchPattern prefixpat;
+    const char *error;
+} regex;
+
+/**
+ * Result of regexMatch() for one row.
+ */
+typedef struct regexStarts {
+    int first; //first match which starts at or right of col, -1 if none
+    int last; //last match which starts at or left of col, -1 if none
+    int count; //number of matches in the row
+    int before; //number of matches which start left of col
+} regexStarts;
+
+regexNode *regexNodeNew(regex *re, int type) {
+    if (re->nnodes == re->nodecap) {
+        re->error = "pattern too complex";
+        return NULL;
     }
-    if (E.cy >= E.rowoff + E.screenrows) { //checks if the cursor is past the bottom of the visible window.
-        E.rowoff = E.cy - E.screenrows + 1;
+    regexNode *n = &re->nodes[re->nnodes++];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    return n;
+}
+
+void regexSetAdd(unsigned char *set, int c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+int regexSetHas(const unsigned char *set, int c) {
+    return set[c >> 3] >> (c & 7) & 1;
+}
+
+/**
+ * This function adds the bytes of the class escape \c to set.
+ * @return 1 if c names a class (d, w, s or the negation in upper case), 0 otherwise
+ */
+int regexEscapeClass(unsigned char *set, int c) {
+    unsigned char tmp[32] = {0};
+    int lower = tolower(c);
+    if (lower != 'd' && lower != 'w' && lower != 's') return 0;
+    for (int b = 0; b < 256; b++) {
+        int in = lower == 'd' ? isdigit(b) : lower == 'w' ? (isalnum(b) || b == '_') : isspace(b);
+        if (in && b < 128) regexSetAdd(tmp, b);
     }
-    if (E.rx < E.coloff) { // checks if the cursor is outside the visible window.
-        E.coloff = E.rx;
+    for (int j = 0; j < 32; j++) set[j] |= c == lower ? tmp[j] : (unsigned char) ~tmp[j];
+    return 1;
+}
+
+/**
+ * Returns the byte meant by the escape \c, e.g. a tab for \t.
+ */
+int regexEscapeChar(int c) {
+    switch (c) {
+        case 't':
+            return '\t';
+        case 'n':
+            return '\n';
+        case 'r':
+            return '\r';
+        default:
+            return c;
+    }
+}
+
+/**
+ * This function finishes a class: with icase both cases of a letter are added, negate inverts the class.
+ */
+void regexSetFinish(unsigned char *set, int icase, int negate) {
+    if (icase)
+        for (int c = 'a'; c <= 'z'; c++)
+            if (regexSetHas(set, c) || regexSetHas(set, c - 'a' + 'A')) {
+                regexSetAdd(set, c);
+                regexSetAdd(set, c - 'a' + 'A');
+            }
+    if (negate)
+        for (int j = 0; j < 32; j++) set[j] = ~set[j];
+}
+
+regexNode *regexParseAlt(regex *re, const char **p, int icase);
+
+/**
+ * Parses a [...] class, *p points behind the '['.
+ */
+regexNode *regexParseClass(regex *re, const char **p, int icase) {
+    regexNode *n = regexNodeNew(re, REGEX_CLASS);
+    if (n == NULL) return NULL;
+    const char *s = *p;
+    int negate = 0;
+    if (*s == '^') {
+        negate = 1;
+        s++;
     }
-    if (E.rx >= E.coloff + E.screencols) { //checks if the cursor is outside the visible window.
-        E.coloff = E.rx - E.screencols + 1;
+    int first = 1;
+    while (*s != ']' || first) {
+        if (*s == '\0') {
+            re->error = "missing ]";
+            return NULL;
+        }
+        first = 0;
+        int lo = (unsigned char) *s++;
+        if (lo == '\\') {
+            if (*s == '\0') {
+                re->error = "trailing \\";
+                return NULL;
+            }
+            if (regexEscapeClass(n->set, *s)) {
+                s++;
+                continue;
+            }
+            lo = regexEscapeChar((unsigned char) *s++);
+        }
+        int hi = lo;
+        if (s[0] == '-' && s[1] != ']' && s[1] != '\0') { //a range like a-z
+            s++;
+            hi = (unsigned char) *s++;
+            if (hi == '\\' && *s != '\0') hi = regexEscapeChar((unsigned char) *s++);
+            if (hi < lo) {
+                re->error = "bad range";
+                return NULL;
+            }
+        }
+        for (int c = lo; c <= hi; c++) regexSetAdd(n->set, c);
     }
+    *p = s + 1;
+    regexSetFinish(n->set, icase, negate);
+    return n;
 }
 
 /**
- * This function gives us useful information about the file like linenumber, if modified and helpful commands
- * @param ab
+ * Parses a single item: a character, a class, a group or an anchor.
  */
-void setStatusBar(struct aBuffer *ab) {
-    abAppend(ab, "\x1b[7m", 4);
-    char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                       E.filename ? E.filename : "[No Name]", E.numrows,
-                       E.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
-                        E.cy + 1, E.numrows);
-    if (len > E.screencols) len = E.screencols;
-    abAppend(ab, status, len);
-    while (len < E.screencols) {
-        if (E.screencols - len == rlen) {
-            abAppend(ab, rstatus, rlen);
-            break;
-        } else {
-            abAppend(ab, " ", 1);
-            len++;
+regexNode *regexParseAtom(regex *re, const char **p, int icase) {
+    const char *s = *p;
+    regexNode *n;
+    switch (*s) {
+        case '(':
+            *p = s + 1;
+            n = regexParseAlt(re, p, icase);
+            if (n == NULL) return NULL;
+            if (**p != ')') {
+                re->error = "missing )";
+                return NULL;
+            }
+            (*p)++;
+            return n;
+        case '[':
+            *p = s + 1;
+            return regexParseClass(re, p, icase);
+        case '^':
+            *p = s + 1;
+            return regexNodeNew(re, REGEX_BOL);
+        case '$':
+            *p = s + 1;
+            return regexNodeNew(re, REGEX_EOL);
+        case '*':
+        case '+':
+        case '?':
+            re->error = "nothing to repeat";
+            return NULL;
+    }
+    n = regexNodeNew(re, REGEX_CLASS);
+    if (n == NULL) return NULL;
+    if (*s == '.') {
+        memset(n->set, 0xff, sizeof(n->set));
+        *p = s + 1;
+        return n;
+    }
+    if (*s == '\\') {
+        s++;
+        if (*s == '\0') {
+            re->error = "trailing \\";
+            return NULL;
+        }
+        if (regexEscapeClass(n->set, *s)) {
+            *p = s + 1;
+            return n;
         }
+        regexSetAdd(n->set, regexEscapeChar((unsigned char) *s));
+    } else {
+        regexSetAdd(n->set, (unsigned char) *s);
     }
-    abAppend(ab, "\x1b[m", 3);
-    abAppend(ab, "\r\n", 2);
+    *p = s + 1;
+    regexSetFinish(n->set, icase, 0);
+    return n;
 }
 
+/**
+ * Parses a counted repetition {m}, {m,} or {m,n}. *p points to the '{'.
+ * @return 1 if it is one, 0 if the '{' is meant literally
+ */
+int regexParseCount(const char **p, int *min, int *max) {
+    const char *s = *p + 1;
+    if (!isdigit((unsigned char) *s)) return 0;
+    long lo = strtol(s, (char **) &s, 10), hi = lo;
+    if (*s == ',') {
+        s++;
+        hi = isdigit((unsigned char) *s) ? strtol(s, (char **) &s, 10) : -1;
+    }
+    *min = lo > INT_MAX ? INT_MAX : lo;
+    *max = hi > INT_MAX ? INT_MAX : hi;
+    if (*s != '}') return 0;
+    *p = s + 1;
+    return 1;
+}
 
 /**
- * This function draws a message bar and then displays that in that bar
- * @param ab
+ * Parses an item followed by any number of *, +, ? and {m,n}.
  */
-void drawStatusBar(struct aBuffer *ab) {
-    abAppend(ab, "\x1b[K", 3);
-    int msglen = strlen(E.statusmsg);
-    if (msglen > E.screencols) msglen = E.screencols;
+regexNode *regexParseRepeat(regex *re, const char **p, int icase) {
+    regexNode *n = regexParseAtom(re, p, icase);
+    while (n) {
+        int min, max;
+        char c = **p;
+        if (c == '*') min = 0, max = -1;
+        else if (c == '+') min = 1, max = -1;
+        else if (c == '?') min = 0, max = 1;
+        else if (c != '{' || !regexParseCount(p, &min, &max)) break;
+        if (c != '{') (*p)++;
+        if (min > 1000 || max > 1000 || (max != -1 && max < min)) {
+            re->error = "bad repetition";
+            return NULL;
+        }
+        regexNode *r = regexNodeNew(re, REGEX_REPEAT);
+        if (r == NULL) return NULL;
+        r->a = n;
+        r->min = min;
+        r->max = max;
+        n = r;
+    }
+    return n;
+}
 
-    abAppend(ab, E.statusmsg, msglen);
+/**
+ * Parses a sequence of items up to a '|', a ')' or the end.
+ */
+regexNode *regexParseCat(regex *re, const char **p, int icase) {
+    regexNode *n = regexNodeNew(re, REGEX_EMPTY);
+    while (n && **p != '\0' && **p != '|' && **p != ')') {
+        regexNode *item = regexParseRepeat(re, p, icase);
+        if (item == NULL) return NULL;
+        regexNode *cat = regexNodeNew(re, REGEX_CAT);
+        if (cat == NULL) return NULL;
+        cat->a = n;
+        cat->b = item;
+        n = cat;
+    }
+    return n;
+}
 
+/**
+ * Parses alternatives separated by '|'.
+ */
+regexNode *regexParseAlt(regex *re, const char **p, int icase) {
+    regexNode *n = regexParseCat(re, p, icase);
+    while (n && **p == '|') {
+        (*p)++;
+        regexNode *alt = regexNodeNew(re, REGEX_ALT);
+        if (alt == NULL) return NULL;
+        alt->a = n;
+        alt->b = regexParseCat(re, p, icase);
+        if (alt->b == NULL) return NULL;
+        n = alt;
+    }
+    return n;
 }
 
 /**
- * This functions setups the field in which the character inout will be handled.
+ * Adds an NFA state.
+ * @return its index, -1 if the pattern gets too large
  */
-void drawField(struct aBuffer *ab) {
-    int y;
-    for (y = 0; y < E.screenrows; y++) {
-        int filerow = y + E.rowoff;
-        if (filerow >= E.numrows) {
-            if (E.numrows == 0 && y == E.screenrows / 3) {
-                char welcome[80];
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                                          "\U0001F4DD \x1b[7m TeCS -- version %s", TECS_VERSION);
-                if (welcomelen > E.screencols) welcomelen = E.screencols;
-                int padding = (E.screencols - welcomelen) / 2;
-                if (padding) {
-                    abAppend(ab, " ", 1);
-                    padding--;
-                }
-                while (padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
+int nfaAdd(regex *re, int type, int out, int out1, const unsigned char *set) {
+    if (re->nnfa == REGEX_NFA_MAX) {
+        re->error = "pattern too large";
+        return -1;
+    }
+    if (re->nnfa == re->nfacap) {
+        re->nfacap = re->nfacap ? re->nfacap * 2 : 64;
+        re->nfa = realloc(re->nfa, re->nfacap * sizeof(nfaState));
+        if (re->nfa == NULL) quit("realloc");
+    }
+    re->nfa[re->nnfa] = (nfaState) {type, out, out1, set};
+    return re->nnfa++;
+}
+
+/**
+ * This function builds the NFA of the reversed node n, which continues with the state next.
+ * Reversing only changes the order of a concatenation.
+ * @return start state of the node, -1 on error
+ */
+int nfaBuild(regex *re, regexNode *n, int next) {
+    if (next < 0) return -1;
+    switch (n->type) {
+        case REGEX_EMPTY:
+            return next;
+        case REGEX_CLASS:
+            return nfaAdd(re, NFA_CHAR, next, -1, n->set);
+        case REGEX_BOL:
+            return nfaAdd(re, NFA_BOL, next, -1, NULL);
+        case REGEX_EOL:
+            return nfaAdd(re, NFA_EOL, next, -1, NULL);
+        case REGEX_CAT:
+            return nfaBuild(re, n->b, nfaBuild(re, n->a, next)); //the right part is read first
+        case REGEX_ALT: {
+            int a = nfaBuild(re, n->a, next);
+            int b = nfaBuild(re, n->b, next);
+            return a < 0 || b < 0 ? -1 : nfaAdd(re, NFA_SPLIT, a, b, NULL);
+        }
+        case REGEX_REPEAT: {
+            int tail = next;
+            if (n->max == -1) { //a loop: a split which either reads the node again or leaves
+                int split = nfaAdd(re, NFA_SPLIT, -1, next, NULL);
+                if (split < 0) return -1;
+                int body = nfaBuild(re, n->a, split);
+                if (body < 0) return -1;
+                re->nfa[split].out = body;
+                tail = split;
             } else {
-                abAppend(ab, " ", 1);
+                for (int j = n->min; j < n->max && tail >= 0; j++) { //optional copies
+                    int body = nfaBuild(re, n->a, tail);
+                    tail = body < 0 ? -1 : nfaAdd(re, NFA_SPLIT, body, next, NULL);
+                }
             }
-        } else {
-            int len = E.row[filerow].rsize - E.coloff;
-            if (len < 0) len = 0;
-            if (len > E.screencols) len = E.screencols;
-            abAppend(ab, &E.row[filerow].render[E.coloff], len);
+            for (int j = 0; j < n->min && tail >= 0; j++) tail = nfaBuild(re, n->a, tail);
+            return tail;
         }
-        abAppend(ab, "\x1b[K", 3);
-        abAppend(ab, "\r\n", 2);
+    }
+    return -1;
+}
 
+/**
+ * Returns the byte a class consists of, or -1 if it has more than one (both cases of a letter count as one
+ * byte with icase).
+ */
+int regexSingle(const unsigned char *set, int icase) {
+    int found = -1;
+    for (int c = 0; c < 256; c++) {
+        if (!regexSetHas(set, c) || (icase && c >= 'A' && c <= 'Z')) continue;
+        if (found != -1) return -1;
+        found = c;
     }
+    return found;
 }
 
 /**
- * This function refreshed the window after each keypress.
+ * This function collects the literal every match of n starts with.
+ * @return 1 if all of n is literal, so the prefix may continue behind it
  */
-void refreshScreen() {
-    scroll();
-    struct aBuffer ab = ABUF_INIT; //init buffer
+int regexPrefix(regex *re, regexNode *n, int *len, int icase) {
+    switch (n->type) {
+        case REGEX_EMPTY:
+        case REGEX_BOL:
+            return 1;
+        case REGEX_CLASS: {
+            int c = regexSingle(n->set, icase);
+            if (c == -1 || *len == REGEX_PREFIX) return 0;
+            re->prefix[(*len)++] = c;
+            return 1;
+        }
+        case REGEX_CAT:
+            return regexPrefix(re, n->a, len, icase) && regexPrefix(re, n->b, len, icase);
+        case REGEX_REPEAT:
+            if (n->min >= 1) regexPrefix(re, n->a, len, icase);
+            return 0;
+    }
+    return 0;
+}
 
-    abAppend(&ab, "\x1b[?25l", 6); //hide cursor
-    abAppend(&ab, "\x1b[H", 3);
+void regexFree(regex *re) {
+    if (re == NULL) return;
+    for (int j = 0; j < re->nstates; j++) {
+        free(re->states[j]->set);
+        free(re->states[j]);
+    }
+    free(re->states);
+    free(re->next);
+    free(re->accept);
+    free(re->hash);
+    free(re->nodes);
+    free(re->nfa);
+    free(re->mark);
+    free(re->stack);
+    free(re->tmp);
+    free(re);
+}
 
-    drawField(&ab);
-    setStatusBar(&ab);
-    drawStatusBar(&ab);
+/**
+ * This function compiles a pattern.
+ * @param pattern
+ * @param icase 1 to ignore the case of ASCII letters
+ * @param error set to a description of the problem if the pattern is invalid
+ * @return the compiled pattern, NULL if it is invalid
+ */
+regex *regexCompile(const char *pattern, int icase, const char **error) {
+    regex *re = calloc(1, sizeof(regex));
+    if (re == NULL) quit("calloc");
+    re->nodecap = 4 * strlen(pattern) + 8;
+    re->nodes = malloc(re->nodecap * sizeof(regexNode));
+    if (re->nodes == NULL) quit("malloc");
+    const char *p = pattern;
+    regexNode *root = regexParseAlt(re, &p, icase);
+    if (root && *p != '\0') re->error = "unmatched )";
+    int prefixlen = 0;
+    if (re->error == NULL) {
+        static const unsigned char any[32] = {
+                255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+                255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255};
+        //matches may end anywhere in the row: the scan loops over any byte before the reversed pattern starts
+        int match = nfaAdd(re, NFA_MATCH, -1, -1, NULL);
+        int begin = nfaBuild(re, root, match);
+        int loop = nfaAdd(re, NFA_CHAR, -1, -1, any);
+        re->start = begin < 0 || loop < 0 ? -1 : nfaAdd(re, NFA_SPLIT, begin, loop, NULL);
+        if (re->start >= 0) re->nfa[loop].out = re->start;
+        regexPrefix(re, root, &prefixlen, icase);
+    }
+    if (re->error) {
+        *error = re->error;
+        regexFree(re);
+        return NULL;
+    }
+    searchCompile(&re->prefixpat, re->prefix, prefixlen, icase);
+    re->states = malloc(REGEX_STATES * sizeof(dfaState *));
+    re->next = malloc(REGEX_STATES * 256 * sizeof(int));
+    re->accept = malloc(REGEX_STATES);
+    re->hash = malloc(2 * REGEX_STATES * sizeof(int));
+    re->mark = calloc(re->nnfa, sizeof(int));
+    re->stack = malloc((re->nnfa * 2 + 2) * sizeof(int));
+    re->tmp = malloc(re->nnfa * sizeof(int));
+    if (!re->states || !re->next || !re->accept || !re->hash || !re->mark || !re->stack || !re->tmp) quit("malloc");
+    for (int j = 0; j < 2 * REGEX_STATES; j++) re->hash[j] = -1;
+    re->dfastart = -1;
+    return re;
+}
 
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
-             (E.rx - E.coloff) +
-             1); //To position the cursor on the screen, we have to subtract E.rowoff from E.cy. Same with E.rx. for horizontal scrolling.
+/**
+ * This function adds the NFA state s and every state reachable from it without reading a byte to the set
+ * in re->tmp. End of row assertions are passed if eol is set, beginning of row assertions if bol is set.
+ * Beginning of row states are kept in the set, so they can be passed once the scan arrives there.
+ * @return new size of the set
+ */
+int nfaClosure(regex *re, int s, int n, int eol, int bol) {
+    int top = 0;
+    re->stack[top++] = s;
+    while (top) {
+        int x = re->stack[--top];
+        if (x < 0 || re->mark[x] == re->markgen) continue;
+        re->mark[x] = re->markgen;
+        nfaState *st = &re->nfa[x];
+        switch (st->type) {
+            case NFA_SPLIT:
+                re->stack[top++] = st->out1;
+                re->stack[top++] = st->out;
+                break;
+            case NFA_EOL:
+                if (eol) re->stack[top++] = st->out;
+                break;
+            case NFA_BOL:
+                re->tmp[n++] = x;
+                if (bol) re->stack[top++] = st->out;
+                break;
+            default:
+                re->tmp[n++] = x;
+        }
+    }
+    return n;
+}
 
-    abAppend(&ab, buf, strlen(buf));
+int intCompare(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
 
-    abAppend(&ab, "\x1b[?25h", 6); //shows cursor l hides cursor
+unsigned dfaHash(const int *set, int n) {
+    unsigned h = 2166136261u;
+    for (int j = 0; j < n; j++) h = (h ^ set[j]) * 16777619u;
+    return h;
+}
 
-    write(STDOUT_FILENO, ab.b, ab.len); //whole screen updates at once
-    aBufferFree(&ab);
+/**
+ * This function drops all DFA states. Used when the cache is full.
+ */
+void dfaFlush(regex *re) {
+    for (int j = 0; j < re->nstates; j++) {
+        free(re->states[j]->set);
+        free(re->states[j]);
+    }
+    re->nstates = 0;
+    for (int j = 0; j < 2 * REGEX_STATES; j++) re->hash[j] = -1;
+    re->dfastart = -1;
+    re->flushes++;
 }
 
 /**
- * This function takes a format string and number of arguments
- * @param fmt
- * @param ... allows to take any number of arguments
+ * This function returns the DFA state of the n NFA states in re->tmp and creates it if needed.
  */
-void setStatusMessage(const char *fmt, ...) {
+int dfaIntern(regex *re, int n) {
+    qsort(re->tmp, n, sizeof(int), intCompare);
+    unsigned h = dfaHash(re->tmp, n) % (2 * REGEX_STATES);
+    for (; re->hash[h] != -1; h = (h + 1) % (2 * REGEX_STATES)) {
+        dfaState *d = re->states[re->hash[h]];
+        if (d->nset == n && memcmp(d->set, re->tmp, n * sizeof(int)) == 0) return re->hash[h];
+    }
+    if (re->nstates == REGEX_STATES) { //the cache is full, start over with this state
+        dfaFlush(re);
+        return dfaIntern(re, n);
+    }
+    dfaState *d = malloc(sizeof(dfaState));
+    if (d == NULL) quit("malloc");
+    d->set = malloc((n ? n : 1) * sizeof(int));
+    if (d->set == NULL) quit("malloc");
+    memcpy(d->set, re->tmp, n * sizeof(int));
+    d->nset = n;
+    d->acceptbol = -1;
+    re->accept[re->nstates] = 0;
+    for (int j = 0; j < n; j++)
+        if (re->nfa[d->set[j]].type == NFA_MATCH) re->accept[re->nstates] = 1;
+    for (int c = 0; c < 256; c++) re->next[re->nstates * 256 + c] = -1;
+    re->hash[h] = re->nstates;
+    re->states[re->nstates] = d;
+    return re->nstates++;
+}
 
-    setlocale(LC_ALL, "en_US.utf8");
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap); //status message with number of seconds
-    va_end(ap);
-    E.statusmsg_time = time(NULL);
+/**
+ * This function computes the DFA state that follows state from on the byte c.
+ */
+int dfaStep(regex *re, int from, unsigned char c) {
+    dfaState *d = re->states[from];
+    int n = 0;
+    re->markgen++;
+    for (int j = 0; j < d->nset; j++) {
+        nfaState *st = &re->nfa[d->set[j]];
+        if (st->type == NFA_CHAR && regexSetHas(st->set, c)) n = nfaClosure(re, st->out, n, 0, 0);
+    }
+    int flushes = re->flushes;
+    int to = dfaIntern(re, n);
+    if (re->flushes == flushes) re->next[from * 256 + c] = to; //from is gone if the cache was flushed
+    return to;
 }
 
-/*** input ***/
 /**
- * This function displays a prompt in the status bar, and lets the user input a line of text after the prompt.
- * @param prompt
- * @param callback
- * @return
+ * Returns 1 if state s accepts at the beginning of the row, where ^ holds.
  */
-char *inputFileName(char *prompt, void (*callback)(char *, int)) {
-    size_t bufsize = 128;
-    char *buf = malloc(bufsize); //input is stored in buf which is dynamically allocated
-    size_t buflen = 0;
-    buf[0] = '\0';
-    while (1) { //infinite loop
-        setStatusMessage(prompt, buf); //sets status message
-        refreshScreen(); //refresh screen
-        int c = readKeypress(); //waits for keypress
-        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) { //allows the user press backspace in the prompt
-            if (buflen != 0) buf[--buflen] = '\0';
-        } else if (c == '\x1b') { //if escape is pressed
-            setStatusMessage("");
-            if (callback) callback(buf, c);
-            free(buf); //free the buf
-            return NULL; //return null
-        } else if (c == '\r') { //when enter pressed
-            if (buflen != 0) { //not empty
-                setStatusMessage(""); //status message cleared
-                if (callback) callback(buf, c); //if we dont want to use callpack we can just pass null
-                return buf; //input returned
-            }
-        } else if (!iscntrl(c) && c <
-                                  128) { //if printable char is entered and also test if char has value less than 128 to check if special char
-            if (buflen == bufsize - 1) { //if buflen reached maximum capacity
-                buf = realloc(buf, bufsize); //allocate the amount of memory before appending to buf
-            }
-            buf[buflen++] = c; //append to buf
-            buf[buflen] = '\0'; //signify end
+int dfaAcceptBol(regex *re, int s) {
+    dfaState *d = re->states[s];
+    if (d->acceptbol == -1) {
+        d->acceptbol = re->accept[s];
+        re->markgen++;
+        for (int j = 0; j < d->nset && !d->acceptbol; j++) {
+            if (re->nfa[d->set[j]].type != NFA_BOL) continue;
+            int n = nfaClosure(re, re->nfa[d->set[j]].out, 0, 0, 1);
+            for (int k = 0; k < n; k++)
+                if (re->nfa[re->tmp[k]].type == NFA_MATCH) d->acceptbol = 1;
         }
-        if (callback) callback(buf, c);
     }
+    return d->acceptbol;
 }
 
 /**
- * Handles the the cursor position
- * @param key pressed
+ * This function adds a match which starts at pos to result.
  */
-void moveCursor(int key) {
-    erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy]; //checks if the cursor is on actual line
+void regexRecord(regexStarts *result, int pos, int col) {
+    result->count++;
+    if (pos < col) result->before++;
+    if (pos >= col) result->first = pos;
+    if (pos <= col && result->last == -1) result->last = pos;
+}
 
-    switch (key) {
-        case ARROW_LEFT:
-            if (E.cx != 0) {
-                E.cx--;
-            } else if (E.cy > 0) { // allows to press <- at beginning of new line to come to previous line's end.
-                E.cy--;
-                E.cx = E.row[E.cy].size;
-            }
+/**
+ * This function finds the matches of the pattern in the len bytes of s.
+ * @param re
+ * @param s
+ * @param len
+ * @param col column the fields first, last and before of result refer to
+ * @param result
+ */
+void regexMatch(regex *re, const char *s, int len, int col, regexStarts *result) {
+    result->first = result->last = -1;
+    result->count = result->before = 0;
+    if (re->prefixpat.len > 0 && searchFind(&re->prefixpat, s, len) == NULL) return; //no match can start
+    if (re->dfastart == -1) {
+        re->markgen++;
+        re->dfastart = dfaIntern(re, nfaClosure(re, re->start, 0, 1, 0));
+    }
+    int state = re->dfastart;
+    const unsigned char *u = (const unsigned char *) s;
+    const int *table = re->next; //the tables stay in place when the cache is flushed
+    const char *accept = re->accept;
+    for (int pos = len; pos > 0; pos--) {
+        if (accept[state]) regexRecord(result, pos, col); //a match starts at pos
+        int next = table[state * 256 + u[pos - 1]];
+        state = next != -1 ? next : dfaStep(re, state, u[pos - 1]);
+    }
+    if (dfaAcceptBol(re, state)) regexRecord(result, 0, col);
+}
+
+/*** find ***/
+char searchPrompt[128]; //prompt of the search, shows whether the case is ignored
+
+/**
+ * This function looks for the pattern in one row.
+ * @param pat
+ * @param row
+ * @param col direction 1: first match which starts at or right of col, -1: last match at or left of col
+ * @param direction
+ * @return index of the match in chars, -1 if there is none
+ */
+int searchRow(const searchPattern *pat, erow *row, int col, int direction) {
+    if (pat->re) {
+        regexStarts starts;
+        regexMatch(pat->re, row->chars, row->size, col, &starts);
+        return direction == 1 ? starts.first : starts.last;
+    }
+    if (direction == 1) {
+        if (col < 0) col = 0;
+        if (col > row->size) return -1;
+        const char *m = searchFind(pat, row->chars + col, row->size - col);
+        return m ? m - row->chars : -1;
+    }
+    int found = -1;
+    const char *p = row->chars;
+    const char *end = row->chars + row->size;
+    const char *m;
+    while (col >= 0 && p <= end && (m = searchFind(pat, p, end - p)) && m - row->chars <= col) {
+        found = m - row->chars;
+        p = m + 1;
+    }
+    return found;
+}
+
+/**
+ * This function counts the matches in a row.
+ * @param pat
+ * @param row
+ * @param col matches which start left of col are added to *before
+ * @param before
+ * @return number of matches
+ */
+int searchCount(const searchPattern *pat, erow *row, int col, int *before) {
+    if (pat->re) {
+        regexStarts starts;
+        regexMatch(pat->re, row->chars, row->size, col, &starts);
+        *before += starts.before;
+        return starts.count;
+    }
+    int count = 0;
+    const char *p = row->chars;
+    const char *end = row->chars + row->size;
+    const char *m;
+    while (p <= end && (m = searchFind(pat, p, end - p))) {
+        if (m - row->chars < col) (*before)++;
+        count++;
+        p = m + 1;
+    }
+    return count;
+}
+
+/**
+ * This function searches from *row, *col in direction and wraps around the ends of the file.
+ * @param pat
+ * @param it row iterator of the calling thread
+ * @param nrows number of rows
+ * @param row start row, the row of the match afterwards
+ * @param col start column, the column of the match afterwards
+ * @param direction 1 forward, -1 backward
+ * @param budget number of bytes after which the search gives up
+ * @param cancel the search stops when this is set, may be NULL
+ * @return 1 if there is a match, 0 if the file has no match, -1 if the search gave up
+ */
+int searchScan(const searchPattern *pat, rowIter *it, int nrows, int *row, int *col, int direction,
+               long long budget, atomic_int *cancel) {
+    int current = *row;
+    int c = *col;
+    for (int i = 0; i <= nrows; i++) { //the row we start in is searched again after wrapping around
+        erow *r = rowIterAt(it, current);
+        int m = searchRow(pat, r, c, direction);
+        if (m != -1) {
+            *row = current;
+            *col = m;
+            return 1;
+        }
+        budget -= r->size + 1;
+        if (budget < 0 || (cancel && i % 1024 == 0 && atomic_load(cancel))) return -1;
+        current += direction;
+        if (current == -1)
+            current = nrows -
+                      1; //causes current to go from the end of the file back to the beginning of the file or vice versa.
+        else if (current == nrows) current = 0;
+        c = direction == 1 ? 0 : rowIterAt(it, current)->size;
+    }
+    return 0;
+}
+
+/**
+ * This function searches the file of --view from the offset from on, reading it in chunks of whole lines,
+ * and wraps around the ends of the file like searchScan().
+ * @param pat
+ * @param from offset in the file where the search starts
+ * @param direction 1 forward, -1 backward
+ * @param found offset of the match afterwards
+ * @param cancel the search stops when this is set
+ * @return 1 if there is a match, 0 if the file has no match, -1 if the search was cancelled
+ */
+int viewSearchScan(const searchPattern *pat, off_t from, int direction, off_t *found, atomic_int *cancel) {
+    off_t size = E.view.size;
+    if (size == 0) return 0;
+    if (from < 0) from = size - 1;
+    if (from >= size) from = 0;
+    char *buf = malloc(TECS_LOAD_CHUNK);
+    if (buf == NULL) return 0;
+    off_t pos = viewLineStart(from), scanned = 0;
+    int col = from - pos; //only for the line the search starts in
+    int r = 0;
+    while (scanned <= size && r == 0) { //the line we start in is searched again after wrapping around
+        if (atomic_load(cancel)) {
+            r = -1;
             break;
-        case ARROW_RIGHT:
-            if (row && E.cx < row->size) {
-                E.cx++;
-            } else if (row && E.cx ==
-                              row->size) { //opposite of <-. This allows user to press -> at the end of a line and appear then at the beginning of next line
-                E.cy++;
-                E.cx = 0;
+        }
+        if (direction == 1) {
+            if (pos >= size) pos = 0;
+            size_t n = viewRead(buf, TECS_LOAD_CHUNK, pos);
+            size_t use = n;
+            char *last = pos + (off_t) n < size ? memrchr(buf, '\n', n) : NULL;
+            if (last) use = last - buf + 1; //the incomplete line is read with the next chunk
+            for (char *p = buf, *end = buf + use; p < end && r == 0; col = 0) {
+                char *nl = memchr(p, '\n', end - p);
+                erow line = {.chars = p, .size = (nl ? nl : end) - p};
+                if (line.size > 0 && p[line.size - 1] == '\r') line.size--;
+                int m = searchRow(pat, &line, col, 1);
+                if (m != -1) {
+                    *found = pos + (p - buf) + m;
+                    r = 1;
+                }
+                p = nl ? nl + 1 : end;
             }
-            break;
-        case ARROW_UP:
-            if (E.cy != 0) {
-                E.cy--;
+            pos += use;
+            scanned += use ? (off_t) use : size; //nothing read, the file has shrunk
+        } else {
+            off_t to = pos; //the lines before pos, the line at pos first
+            if (col >= 0) {
+                size_t n = viewRead(buf, TECS_LOAD_CHUNK, pos);
+                char *nl = memchr(buf, '\n', n);
+                erow line = {.chars = buf, .size = nl ? nl - buf : (int) n};
+                if (line.size > 0 && buf[line.size - 1] == '\r') line.size--;
+                int m = searchRow(pat, &line, col, -1);
+                if (m != -1) {
+                    *found = pos + m;
+                    r = 1;
+                    break;
+                }
+                col = -1;
             }
-            break;
-        case ARROW_DOWN:
-            if (E.cy < E.numrows) {
-                E.cy++;
+            if (to == 0) to = size;
+            off_t start = to > TECS_LOAD_CHUNK ? to - TECS_LOAD_CHUNK : 0;
+            size_t n = viewRead(buf, to - start, start);
+            size_t skip = 0;
+            char *first = start > 0 ? memchr(buf, '\n', n) : NULL;
+            if (first) skip = first - buf + 1; //the incomplete line is read with the next chunk
+            size_t e = n;
+            if (e > skip && buf[e - 1] == '\n') e--;
+            while (r == 0) {
+                char *nl = e > skip ? memrchr(buf + skip, '\n', e - skip) : NULL;
+                size_t b = nl ? (size_t) (nl - buf) + 1 : skip;
+                erow line = {.chars = buf + b, .size = e - b};
+                if (line.size > 0 && line.chars[line.size - 1] == '\r') line.size--;
+                int m = searchRow(pat, &line, line.size, -1);
+                if (m != -1) {
+                    *found = start + b + m;
+                    r = 1;
+                }
+                if (!nl) break;
+                e = b - 1;
             }
-            break;
-    }
-
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-    int rowlen = row ? row->size : 0;
-    if (E.cx > rowlen) { //if cx is to the right of the end of that line
-        E.cx = rowlen; //set cx as end of that line
+            pos = start + skip;
+            scanned += n - skip ? (off_t) (n - skip) : size;
+        }
     }
+    free(buf);
+    return r;
 }
 
 /**
- * This function converts our array of erow structs into a single string, so that its ready
- * to be written out to a file.
- * @param buflen saves the lenght of text
- * @return buf
+ * Search thread. It first looks for the match from the start position of the job, then counts all
+ * matches of the file and how many of them come before that match. The counters are published
+ * while the thread runs, so the status bar can show them as they grow.
  */
-char *rowToString(int *buflen) {
-    int totlen = 0;
-    int j;
-    for (j = 0; j < E.numrows; j++)
-        totlen += E.row[j].size +
-                  1; //adds up the lengths of each row of text and adding 1 to each one for the newline character we’ll add to the end of each line
-    *buflen = totlen; //save the total length into buflen, to tell the caller how long the string is
-    char *buf = malloc(totlen); //allocating required memory
-    char *p = buf;
-    for (j = 0; j < E.numrows; j++) { //loop through the rows
-        memcpy(p, E.row[j].chars, E.row[j].size); //copy the contents of each row to the end of the buffer
-        p += E.row[j].size;
-        *p = '\n'; //appending a new line character after each row
-        p++;
+void *searchThread(void *arg) {
+    struct searchJob *job = arg;
+    long long t = traceBegin();
+    searchPattern pat;
+    const char *error;
+    searchCompile(&pat, job->query, job->len, job->icase);
+    if (job->isregex) pat.re = regexCompile(job->query, job->icase, &error);
+    if (job->view) { //the file is read, the rows only hold the window
+        off_t found = 0;
+        int r = job->isregex && pat.re == NULL ? 0 :
+                viewSearchScan(&pat, job->offset, job->direction, &found, &job->cancel);
+        regexFree(pat.re);
+        job->foundoff = found;
+        if (r != -1) atomic_store(&job->found, r == 1 ? 1 : -1);
+        atomic_store(&job->done, 1);
+        traceEnd("searchThread", t);
+        return NULL;
     }
-    return buf;
+    rowIter it = {NULL, 0};
+    int row = job->row, col = job->col;
+    int r = job->isregex && pat.re == NULL ? 0 :
+            searchScan(&pat, &it, job->numrows, &row, &col, job->direction, LLONG_MAX, &job->cancel);
+    if (r == -1) { //cancelled
+        regexFree(pat.re);
+        traceEnd("searchThread", t);
+        return NULL;
+    }
+    if (r == 0) {
+        regexFree(pat.re);
+        atomic_store(&job->found, -1);
+        atomic_store(&job->done, 1);
+        traceEnd("searchThread", t);
+        return NULL;
+    }
+    job->foundrow = row;
+    job->foundcol = col;
+    atomic_store(&job->found, 1);
+    int total = 0, before = 0;
+    for (int j = 0; j < job->numrows; j++) {
+        if (j % 1024 == 0) {
+            if (atomic_load(&job->cancel)) break;
+            atomic_store(&job->total, total);
+        }
+        erow *rr = rowIterAt(&it, j);
+        total += searchCount(&pat, rr, j < row ? INT_MAX : j == row ? col : 0, &before);
+        if (j == row) atomic_store(&job->before, before);
+    }
+    regexFree(pat.re);
+    traceEnd("searchThread", t);
+    if (atomic_load(&job->cancel)) return NULL;
+    atomic_store(&job->total, total);
+    atomic_store(&job->done, 1);
+    return NULL;
 }
 
 /**
- * This method opens and reads a file from the disk. It takes the filename and opens the file.
- * @param filename file which will be opened and read.
+ * This function stops the running search thread, if any.
  */
-void readFile(char *filename) {
-    free(E.filename);
-    E.filename = strdup(filename);
-    setlocale(LC_ALL, "de-CH.utf8");
-    FILE *fp = fopen(filename, "r"); //opens the file
-    if (!fp) quit("fopen");
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    while ((linelen = getline(&line, &linecap, fp)) != -1) { //allows to read an entire file into E.row
-        while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                               line[linelen - 1] == '\r'))
-            linelen--;
-        insertRow(E.numrows, line, linelen);
+void searchJobCancel() {
+    struct searchJob *job = &E.search;
+    if (job->running) {
+        atomic_store(&job->cancel, 1);
+        pthread_join(job->thread, NULL);
+        job->running = 0;
     }
-    free(line); //freeing from allocation
-    fclose(fp);
-    E.dirty = 0;
+    free(job->query);
+    job->query = NULL;
 }
 
 /**
- * This function writes the string returned by rowToString() to disk.
+ * This function starts a search thread for query from row, col in direction.
+ * The previous search thread is cancelled first.
  */
-void saveFile() {
-    if (E.filename == NULL) { //if its a new file
-        E.filename = inputFileName("Save as: %s (ESC to cancel)", NULL);
-        if (E.filename == NULL) { //if save is cancelled
-
-            time(&raw_time);
-            info = localtime(&raw_time);
+void searchJobStart(const char *query, int icase, int isregex, int row, int col, int direction) {
+    struct searchJob *job = &E.search;
+    searchJobCancel();
+    job->query = strdup(query);
+    job->len = strlen(query);
+    job->icase = icase;
+    job->isregex = isregex;
+    job->row = row;
+    job->col = col;
+    job->direction = direction;
+    job->numrows = E.numrows;
+    job->view = E.view.on;
+    job->offset = E.view.on ? viewRowOffset(row) + col : 0;
+    job->applied = 0;
+    job->k = 0;
+    atomic_store(&job->cancel, 0);
+    atomic_store(&job->found, 0);
+    atomic_store(&job->total, 0);
+    atomic_store(&job->before, -1);
+    atomic_store(&job->done, 0);
+    if (job->query == NULL) return;
+    if (pthread_create(&job->thread, NULL, searchThread, job) == 0) job->running = 1;
+    else searchThread(job); //no thread available, search right here
+}
 
-            char *s = concat("\U00002139: Ctrl-S   \U0001F4BE |Ctrl-Q   \U0001F6AB | Ctrl-F  \U0001F50D |\U000023F1  ",
-                             asctime(info));
-            setStatusMessage(s);
-            return;
-        }
+/**
+ * This function takes over the results of the search thread: it moves the cursor to the match the thread
+ * found and works out the number of the current match. Finished threads are joined.
+ * @return 1 if the screen needs to be redrawn
+ */
+int searchPoll() {
+    struct searchJob *job = &E.search;
+    if (!job->active || job->query == NULL) return 0;
+    int changed = 0;
+    if (atomic_load(&job->found) == 1 && !job->applied && job->view) {
+        off_t ls = viewLineStart(job->foundoff);
+        viewLoad(ls, -1);
+        E.cx = job->foundoff - ls;
+        E.rowoff = E.numrows;
+        job->applied = 1;
+        changed = 1;
+    } else if (atomic_load(&job->found) == 1 && !job->applied) {
+        E.cy = job->foundrow;
+        E.cx = job->foundcol;
+        E.rowoff = E.numrows;
+        job->applied = 1;
+        changed = 1;
     }
-
-    int len;
-    char *buf = rowToString(&len); //call rowToString function
-    int fd = open(E.filename, O_RDWR | O_CREAT,
-                  0644); //create a file, open it for reading and writing. 0644 is standard permission for text files.
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) { //if no error, then ftruncate sets file size to specified length.
-            if (write(fd, buf, len) == len) {
-                close(fd); //close the file
-                free(buf); //free the memory that buf points to
-                E.dirty = 0;
-                setStatusMessage("%d bytes written to disk", len); //notifies user if save succeeded
-                return; //write
-            }
-        }
-        close(fd);
+    int before = atomic_load(&job->before);
+    if (job->k == 0 && before >= 0) {
+        job->k = before + 1;
+        changed = 1;
     }
-    free(buf);
-    setStatusMessage("Can't save! I/O error: %s", strerror(errno)); //notifies user if save didnt succeed.
+    if (job->running && atomic_load(&job->done)) {
+        pthread_join(job->thread, NULL);
+        job->running = 0;
+        changed = 1;
+    }
+    return changed;
+}
+
+/**
+ * This function writes the search progress for the status bar, e.g. "match 3 of 120".
+ * @return length of the text
+ */
+int searchStatus(char *buf, int size) {
+    struct searchJob *job = &E.search;
+    if (job->error) return snprintf(buf, size, "%s", job->error);
+    if (job->query == NULL) return snprintf(buf, size, "no matches");
+    if (atomic_load(&job->found) == 0) return snprintf(buf, size, "searching...");
+    if (atomic_load(&job->found) == -1) return snprintf(buf, size, "no matches");
+    if (job->view) //matches aren't counted in a view
+        return snprintf(buf, size, "match at %d%%", (int) (job->foundoff * 100 / (E.view.size ? E.view.size : 1)));
+    int done = atomic_load(&job->done);
+    int total = atomic_load(&job->total);
+    if (job->k == 0) return snprintf(buf, size, "match ? of %d%s", total, done ? "" : "+");
+    return snprintf(buf, size, "match %d of %d%s", job->k, total, done ? "" : "+");
 }
 
-/*** find ***/
 /**
  * This function is a callback function for our search function searchWord().
+ * A changed query is searched from the current match on, so typing more characters refines the match
+ * in place. The arrow keys jump to the next or previous match, Ctrl-C toggles ignoring the case.
+ * Only the rows near the cursor are searched here, everything else is left to the search thread,
+ * so the prompt stays responsive in huge files.
  */
 void searchCallback(char *query, int key) {
-    static int last_match = -1; //last match of search
-    static int direction = 1; // stores direction of search
+    static int icase = 0; //1 while the search ignores the case
+    static int isregex = 0; //1 while the query is a regular expression
+    int direction = 1; //stores direction of search
+    int skip = 0; //1 if the match under the cursor doesn't count
+    struct searchJob *job = &E.search;
+    long long t = traceBegin();
 
     if (key == '\r' || key == '\x1b') { //checks whether we pressed Enter or Escape
-        last_match = -1;
-        direction = 1;
+        searchJobCancel();
+        job->active = 0;
+        traceEnd("searchCallback", t);
         return;
     } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
+        skip = 1;
     } else if (key == ARROW_LEFT || key == ARROW_UP) {
         direction = -1;
+        skip = 1;
+    } else if (key == CTRL_KEY('c')) {
+        icase = !icase;
+    } else if (key == CTRL_KEY('r')) {
+        isregex = !isregex;
+    }
+    snprintf(searchPrompt, sizeof(searchPrompt), "Search%s%s: %%s (ESC/Arrows/Enter, Ctrl-C case, Ctrl-R regex)",
+             isregex ? " regex" : "", icase ? " (ignore case)" : "");
+    job->error = NULL;
+    if (query[0] == '\0' || E.numrows == 0) {
+        searchJobCancel();
+        job->active = 0;
+        traceEnd("searchCallback", t);
+        return;
+    }
+    job->active = 1;
+    if (E.view.on) { //only the window is in memory, the search thread reads the file
+        int row = E.cy < E.numrows ? E.cy : 0;
+        searchJobStart(query, icase, isregex, row, E.cy < E.numrows ? E.cx + skip * direction : 0, direction);
+        traceEnd("searchCallback", t);
+        return;
+    }
+
+    searchPattern pat;
+    searchCompile(&pat, query, strlen(query), icase);
+    if (isregex && (pat.re = regexCompile(query, icase, &job->error)) == NULL) {
+        searchJobCancel(); //the status bar shows what is wrong with the pattern
+        traceEnd("searchCallback", t);
+        return;
+    }
+    int row = E.cy < E.numrows ? E.cy : 0; //index of the current row we are searching
+    int col = E.cy < E.numrows ? E.cx + skip * direction : 0;
+    int startrow = row, startcol = col;
+    int r = searchScan(&pat, &E.rowcache, E.numrows, &row, &col, direction, TECS_SEARCH_SYNC, NULL);
+    regexFree(pat.re);
+    if (r == 1) {
+        E.cy = row;
+        E.cx = col;
+        E.rowoff = E.numrows;
+        int total = atomic_load(&job->total);
+        if (skip && job->query && atomic_load(&job->done) && job->k > 0 && total > 0) { //count is known
+            job->k = direction == 1 ? job->k % total + 1 : (job->k + total - 2) % total + 1;
+        } else {
+            searchJobStart(query, icase, isregex, row, col, 1); //count the matches around the new one
+            job->applied = 1;
+        }
+    } else if (r == -1) { //not near the cursor, the search thread finds it
+        searchJobStart(query, icase, isregex, startrow, startcol, direction);
     } else {
-        last_match = -1;
-        direction = 1;
+        searchJobCancel(); //no match at all
     }
-    if (last_match == -1) direction = 1;
-    int current = last_match; //index of the current row we are searching
-    int i;
-    for (i = 0; i < E.numrows; i++) {
-        current += direction;
-        if (current == -1)
-            current = E.numrows -
-                      1; //causes current to go from the end of the file back to the beginning of the file or vice versa.
-        else if (current == E.numrows) current = 0;
-        erow *row = &E.row[current];
-        char *match = strstr(row->render, query);
-        if (match) {
-            last_match = current; //when we find a match, we set last_match to current
-            E.cy = current;
-            E.cx = rXToCx(row, match - row->render);
-            E.rowoff = E.numrows;
+    traceEnd("searchCallback", t);
+}
 
-            break;
+/**
+ * The event loop. It sleeps in poll() until a key arrives, the terminal is resized or a timer is due,
+ * so an idle editor uses no CPU. While the loader or the search thread is busy, their work goes on in
+ * between and the screen is refreshed when a search result arrives and otherwise at most every 100
+ * milliseconds. Returns as soon as a key is waiting.
+ */
+void waitForInput() {
+    static long long lastdraw = 0;
+    struct pollfd pfd[3] = {{STDIN_FILENO, POLLIN, 0}, {E.sigpipe[0], POLLIN, 0}, {-1, POLLIN, 0}};
+    while (1) {
+        int timeout = timerNext();
+        if (E.follow.on) {
+            pfd[2].fd = E.follow.inotify;
+            int shown = followRead();
+            long long now = monotonicMs();
+            if (shown == 1 || (shown == 0 && now - lastdraw >= 100)) {
+                refreshScreen();
+                lastdraw = now;
+            } else if (shown == 0) {
+                timerStart(TIMER_FOLLOW, 100, followTick); //only the line count changed, it is drawn soon
+            }
+            if (E.follow.pending && !E.load.active && !E.search.running) timeout = 0;
         }
+        if (E.load.active || E.search.running) {
+            int made = 0;
+            if (E.load.active && !E.search.running) made = loaderStep(TECS_LOAD_STEP); //rows can't change under a search
+            int changed = searchPoll();
+            long long now = monotonicMs();
+            if (changed || now - lastdraw >= 100 || (!E.load.active && !E.search.running)) {
+                refreshScreen();
+                lastdraw = now;
+            }
+            if (made) timeout = 0;
+            else if (timeout == -1 || timeout > 10) timeout = 10;
+        }
+        pfd[0].revents = pfd[1].revents = pfd[2].revents = 0;
+        if (poll(pfd, 3, timeout) == -1 && errno != EINTR) quit("poll");
+        if (pfd[2].revents & POLLIN) followEvents();
+        int redraw = 0;
+        if (pfd[1].revents & POLLIN) {
+            windowResize();
+            redraw = 1;
+        }
+        if (timerRun()) redraw = 1;
+        if (pfd[0].revents & (POLLIN | POLLHUP)) return; //a key is waiting
+        if (redraw) refreshScreen();
     }
 }
 
@@ -895,16 +5785,17 @@ void searchWord() {
     int saved_cy = E.cy;
     int saved_colOff = E.coloff;
     int saved_rowOff = E.rowoff;
-    char *word = inputFileName("Search: %s (Use ESC/Arrows/Enter)",
-                               searchCallback);
-    time(&raw_time);
-    info = localtime(&raw_time);
-
-    char *s = concat("\U00002139: Ctrl-S   \U0001F4BE |Ctrl-Q   \U0001F6AB | Ctrl-F  \U0001F50D |\U000023F1  ",
-                     asctime(info));
-    setStatusMessage(s);
+    off_t saved_off = E.view.on ? viewRowOffset(E.cy) : 0; //a view can move its window while searching
+    searchCallback("", 0); //sets up searchPrompt
+    char *word = inputFileName(searchPrompt, searchCallback);
+    infoBar();
     if (word) {
         free(word);
+    } else if (E.view.on) {
+        viewLoad(saved_off, -1);
+        E.cx = saved_cx;
+        E.coloff = saved_colOff;
+        E.rowoff = E.cy - (saved_cy - saved_rowOff) > 0 ? E.cy - (saved_cy - saved_rowOff) : 0;
     } else {
         E.cx = saved_cx;
         E.cy = saved_cy;
@@ -913,13 +5804,239 @@ void searchWord() {
     }
 }
 
+/**
+ * Changes one replace thread found in its rows. For every row with matches the bytes from the start of the
+ * first match to the end of the last one are rewritten, the new bytes of all rows go to text and the
+ * columns of the matches to cols.
+ */
+struct replaceWork {
+    const searchPattern *pat;
+    const char *with; //the replacement
+    int wlen;
+    int from, to; //rows of the thread
+    char *text;
+    size_t len, cap;
+    struct replaceEdit {
+        int row, col, len; //bytes of row from col on which are replaced
+        size_t text; //offset of the new bytes in text
+        int textlen;
+        long long match; //index of the first match of the row in cols
+    } *edits;
+    int n, ecap;
+    int *cols; //column of every match
+    long long count, ccap; //number of matches and size of cols
+};
+
+/**
+ * This function appends len bytes of s to the new text of a replace thread.
+ */
+void replaceText(struct replaceWork *w, const char *s, size_t len) {
+    if (w->len + len > w->cap) {
+        w->cap = w->cap * 2 > w->len + len ? w->cap * 2 : w->len + len + 4096;
+        w->text = realloc(w->text, w->cap);
+        if (w->text == NULL) quit("realloc");
+    }
+    if (len > 0) memcpy(w->text + w->len, s, len); //an empty replacement has no text yet
+    w->len += len;
+}
+
+/**
+ * Replace thread. It looks for the matches in its rows and builds their new contents, the rows themselves
+ * are only read, so the threads need no locks. The main thread applies the changes afterwards.
+ */
+void *replaceThread(void *arg) {
+    struct replaceWork *w = arg;
+    long long t = traceBegin();
+    rowIter it = {NULL, 0};
+    for (int j = w->from; j < w->to; j++) {
+        erow *row = rowIterAt(&it, j);
+        const char *p = row->chars;
+        const char *end = row->chars + row->size;
+        const char *m;
+        int first = -1;
+        size_t start = w->len;
+        long long matches = w->count;
+        while ((m = searchFind(w->pat, p, end - p))) {
+            if (first == -1) first = m - row->chars;
+            else replaceText(w, p, m - p); //the bytes between two matches stay
+            replaceText(w, w->with, w->wlen);
+            p = m + w->pat->len;
+            if (w->count == w->ccap) {
+                w->ccap = w->ccap ? w->ccap * 2 : 1024;
+                w->cols = realloc(w->cols, w->ccap * sizeof(int));
+                if (w->cols == NULL) quit("realloc");
+            }
+            w->cols[w->count++] = m - row->chars;
+        }
+        if (first == -1) continue;
+        if (w->n == w->ecap) {
+            w->ecap = w->ecap ? w->ecap * 2 : 1024;
+            w->edits = realloc(w->edits, w->ecap * sizeof(struct replaceEdit));
+            if (w->edits == NULL) quit("realloc");
+        }
+        w->edits[w->n++] = (struct replaceEdit) {j, first, (int) (p - row->chars) - first, start, (int) (w->len - start),
+                                                 matches};
+    }
+    traceEnd("replaceThread", t);
+    return NULL;
+}
+
+/**
+ * This function replaces every occurrence of query in the file with with. The rows are searched in batches,
+ * each batch split among up to TECS_REPLACE_THREADS threads, and every row with matches is rewritten once
+ * with rowReplaceString(). The undo journal gets a single record with the places of the matches instead of
+ * the old and the new text of every row, so one undo takes a replacement of a huge file back. The query
+ * is matched literally and case-sensitively whatever modes the search is in: the record holds no matched
+ * text, undo puts the query itself back.
+ * @param query
+ * @param with
+ * @param rows gets the number of rows which changed
+ * @return number of replacements
+ */
+long long replaceAll(const char *query, const char *with, int *rows) {
+    long long t = traceBegin();
+    searchJobCancel(); //the search thread reads the rows
+    loaderFinish();
+    searchPattern pat;
+    searchCompile(&pat, query, strlen(query), 0);
+    undoRecord *rec = NULL; //started with the first match
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    if (cpus > TECS_REPLACE_THREADS) cpus = TECS_REPLACE_THREADS;
+    struct replaceWork work[TECS_REPLACE_THREADS];
+    pthread_t threads[TECS_REPLACE_THREADS];
+    int started[TECS_REPLACE_THREADS]; //1 if the work runs in threads[i]
+    memset(work, 0, sizeof(work));
+    long long count = 0;
+    *rows = 0;
+    for (int batch = 0; batch < E.numrows; batch += TECS_REPLACE_BATCH) {
+        int end = E.numrows - batch < TECS_REPLACE_BATCH ? E.numrows : batch + TECS_REPLACE_BATCH;
+        int nthreads = (end - batch + 4095) / 4096 < cpus ? (end - batch + 4095) / 4096 : cpus; //few rows: one thread
+        int per = (end - batch + nthreads - 1) / nthreads;
+        for (int i = 0; i < nthreads; i++) {
+            struct replaceWork *w = &work[i];
+            w->pat = &pat;
+            w->with = with;
+            w->wlen = strlen(with);
+            w->from = batch + i * per < end ? batch + i * per : end;
+            w->to = w->from + per < end ? w->from + per : end;
+            w->len = 0;
+            w->n = 0;
+            w->count = 0;
+            started[i] = i > 0 && pthread_create(&threads[i], NULL, replaceThread, w) == 0;
+        }
+        for (int i = 0; i < nthreads; i++) {
+            if (started[i]) pthread_join(threads[i], NULL);
+            else replaceThread(&work[i]); //the first part, or no thread was available
+        }
+        for (int i = 0; i < nthreads; i++) { //the threads are done, the rows can change
+            struct replaceWork *w = &work[i];
+            for (int j = 0; j < w->n; j++) { //in row order
+                struct replaceEdit *e = &w->edits[j];
+                rowReplaceString(e->row, e->col, e->len, w->text + e->text, e->textlen);
+                if (rec == NULL) rec = undoRecordReplace(query, strlen(query), with, strlen(with));
+                long long last = j + 1 < w->n ? w->edits[j + 1].match : w->count;
+                for (long long k = e->match; rec && k < last; k++) undoRecordMatch(rec, e->row, w->cols[k]);
+            }
+            count += w->count;
+            *rows += w->n;
+        }
+    }
+    for (int i = 0; i < TECS_REPLACE_THREADS; i++) {
+        free(work[i].text);
+        free(work[i].edits);
+        free(work[i].cols);
+    }
+    if (rec) undoTrim();
+    traceEnd("replaceAll", t);
+    return count;
+}
+
+/**
+ * This function asks for the text to look for and the text to replace it with, and replaces all of its
+ * occurrences. The status bar tells how many there were and how many replacements a second that made.
+ */
+void replaceWord() {
+    char *query = inputFileName("Replace (literal, case-sensitive): %s (ESC to cancel)", NULL);
+    infoBar();
+    if (query == NULL) return;
+    char prompt[192] = "Replace ";
+    int len = strlen(prompt);
+    int n = strlen(query);
+    if (n > 60) n = utf8Start(query, n, 60); //a long query is cut in front of a character
+    n = utf8Fit(query, n, 40, NULL);
+    for (int j = 0; j < n; j++) { //the prompt is a format string
+        if (query[j] == '%') prompt[len++] = '%';
+        prompt[len++] = query[j];
+    }
+    snprintf(prompt + len, sizeof(prompt) - len, " with: %%s (ESC to cancel)");
+    char *with = inputPrompt(prompt, NULL, 1);
+    infoBar();
+    if (with == NULL) {
+        free(query);
+        return;
+    }
+    int rows;
+    long long start = hudNow();
+    long long count = replaceAll(query, with, &rows);
+    double seconds = (hudNow() - start) / 1e9;
+    if (E.cy < E.numrows) { //the row under the cursor may have become shorter
+        erow *row = rowAt(E.cy);
+        if (E.cx > row->size) E.cx = row->size;
+        else if (E.cx < row->size) E.cx = utf8Start(row->chars, row->size, E.cx);
+    }
+    if (count == 0) setStatusMessage("No occurrences of %.40s", query);
+    else
+        setStatusMessage("%lld replacements in %d lines, %.0f per second%s", count, rows,
+                         count / (seconds > 1e-6 ? seconds : 1e-6),
+                         E.undo.skip == E.undo.group ? " (too large to undo)" : "");
+    free(query);
+    free(with);
+}
+
+/**
+ * This function asks for a line number and moves the cursor there, e.g. to the line of a compiler error.
+ * "line:column" also sets the column and "@offset" goes to a byte offset of the file. The row tree finds
+ * both in O(log n).
+ */
+void gotoLine() {
+    char *input = inputFileName("Go to line: %s (line, line:column or @byte offset, ESC to cancel)", NULL);
+    infoBar();
+    if (input == NULL) return;
+    int y, x = 0;
+    if (input[0] == '@') {
+        loaderFinish(); //offsets count all rows
+        y = rowAtOffset(atoll(input + 1), &x);
+    } else {
+        long long line = atoll(input);
+        char *colon = strchr(input, ':');
+        if (colon) x = atoi(colon + 1) - 1;
+        if (line > E.numrows && E.load.active) loaderFinish();
+        y = line < 1 ? 0 : line > E.numrows ? E.numrows - 1 : line - 1;
+    }
+    free(input);
+    if (y >= E.numrows) y = E.numrows - 1;
+    if (y < 0) y = 0;
+    int size = y < E.numrows ? rowAt(y)->size : 0;
+    E.cy = y;
+    E.cx = x < 0 ? 0 : x > size ? size : x;
+    if (E.cx < size) E.cx = utf8Start(rowAt(y)->chars, size, E.cx);
+    E.rowoff = E.cy > E.screenrows / 2 ? E.cy - E.screenrows / 2 : 0; //the line in the middle of the screen
+}
+
 /**
  * This function waits for a keypress, and then handles it.
  */
 void checkKeyPress() {
     static int quit_times = TECS_QUIT_TIMES; //tracks how many times the user presses ctrl-q
+    static int info_pressed = 0; //1 if the previous key was a ctrl-i which showed the info bar
     int c = readKeypress();
+    if (E.hud.on) hudPhase(HUD_INPUT);
+    int info_again = info_pressed && c == CTRL_KEY('i');
+    info_pressed = 0;
 
+    undoBegin();
+    if (E.view.on && viewKeypress(c)) c = '\x1b'; //handled or refused, nothing more to do
     switch (c) {
         case '\r': //Enter key
             insertNewline();
@@ -935,6 +6052,7 @@ void checkKeyPress() {
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
             system("clear");
+            autosaveClose();
             exit(0);
             break;
 
@@ -943,25 +6061,42 @@ void checkKeyPress() {
             break;
 
         case CTRL_KEY('i'):
-            time(&raw_time);
-            info = localtime(&raw_time);
-
-            char *s = concat("\U00002139: Ctrl-S   \U0001F4BE |Ctrl-Q   \U0001F6AB | Ctrl-F  \U0001F50D | \U000023F1 ",
-                             asctime(info));
-            setStatusMessage(s);
+            if (info_again) { //pressed twice in a row
+                hudToggle();
+                break;
+            }
+            infoBar();
+            info_pressed = 1;
             break;
         case HOME_KEY:
             E.cx = 0; //moves the cursor to the left side of the screen
             break;
         case END_KEY:
             if (E.cy < E.numrows)
-                E.cx = E.row[E.cy].size; //allows to move the cursor to the end of current line with end key
+                E.cx = rowAt(E.cy)->size; //allows to move the cursor to the end of current line with end key
             break;
 
         case CTRL_KEY('f'): //search function key
             searchWord();
             break;
 
+        case CTRL_KEY('g'): //go to line
+            gotoLine();
+            break;
+
+        case CTRL_KEY('r'): //replace all
+            replaceWord();
+            break;
+
+        case CTRL_KEY('n'): //line numbers on and off
+            E.numbers = !E.numbers;
+            break;
+
+        case CTRL_KEY('z'): //undo
+        case CTRL_KEY('y'): //redo
+            undoStep(c == CTRL_KEY('y'));
+            break;
+
         case BACKSPACE:
         case CTRL_KEY('h'): //ascii for backspace
         case DEL_KEY:
@@ -990,6 +6125,10 @@ void checkKeyPress() {
             moveCursor(c);
             break;
 
+        case PASTE:
+            insertText(E.paste, E.pastelen);
+            break;
+
         case '\x1b':
             break;
 
@@ -997,6 +6136,11 @@ void checkKeyPress() {
             insertChar(c); //any keypress which isn't mapped will be inserted directly
             break;
     }
+    undoEnd();
+    if (E.hud.on) {
+        hudPhase(HUD_EDIT);
+        E.hud.keys++;
+    }
 
     quit_times = TECS_QUIT_TIMES; //if user presses any other key then ctrl-quit, then it gets reset back to 3
 }
@@ -1012,13 +6156,30 @@ void initializeEditor() {
     E.rowoff = 0;
     E.coloff = 0;
     E.numrows = 0;
-    E.row = NULL;
+    E.rowroot = NULL;
+    E.rowcache.block = NULL;
     E.dirty = 0;
     E.filename = NULL;
+    E.map = NULL;
+    E.mapsize = 0;
+    E.mapino = 0;
+    E.load.active = 0;
+    E.search.active = 0;
+    E.search.running = 0;
+    E.search.query = NULL;
+    memset(&E.text, 0, sizeof(E.text));
+    memset(&E.undo, 0, sizeof(E.undo));
+    memset(&E.hud, 0, sizeof(E.hud));
+    E.shadow = NULL;
+    E.shadowlines = 0;
+    E.inlen = E.inpos = 0;
+    E.paste = NULL;
+    E.pastelen = E.pastecap = 0;
+    E.fullredraw = 1;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    if (windowSize(&E.screenrows, &E.screencols) == -1) quit("windowSize");
-    E.screenrows -= 2;
+    memset(E.timers, 0, sizeof(E.timers));
+    E.sigpipe[0] = E.sigpipe[1] = -1;
 }
 
 /**
@@ -1037,32 +6198,365 @@ char *concat(const char *s1, const char *s2) {
     return result;
 }
 
+/*** bench ***/
+#ifdef TECS_BENCH
+/*
+ * Headless benchmark of the editing core, built by "make bench". It works on a generated file without
+ * a terminal and prints the results as JSON, one object per workload, so runs can be compared.
+ */
+#define BENCH_MAX_SAMPLES 200000
+
+/**
+ * Timing of one workload: the latency of every operation and the bytes it processed.
+ */
+typedef struct benchResult {
+    const char *name;
+    double *samples; //latency of each operation in seconds
+    int n;
+    double total; //seconds
+    long long bytes; //bytes processed, 0 if throughput in bytes makes no sense
+    long long items; //e.g. replacements made, 0 if the operations have none
+} benchResult;
+
+int benchFirst = 1; //1 until the first result is printed
+
+double benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void benchStart(benchResult *r, const char *name) {
+    r->name = name;
+    r->samples = malloc(BENCH_MAX_SAMPLES * sizeof(double));
+    if (r->samples == NULL) quit("malloc");
+    r->n = 0;
+    r->total = 0;
+    r->bytes = 0;
+    r->items = 0;
+}
+
+void benchAdd(benchResult *r, double start) {
+    double t = benchNow() - start;
+    if (r->n < BENCH_MAX_SAMPLES) r->samples[r->n++] = t;
+    r->total += t;
+}
+
+int benchCompare(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+double benchPercentile(benchResult *r, double p) {
+    int j = (int) (p * (r->n - 1) + 0.5);
+    return r->samples[j] * 1e6;
+}
+
+/**
+ * This function prints a result as a JSON object and frees it.
+ */
+void benchReport(benchResult *r) {
+    qsort(r->samples, r->n, sizeof(double), benchCompare);
+    printf("%s\n    {\"name\": \"%s\", \"ops\": %d, \"total_s\": %.6f, \"ops_per_s\": %.1f, "
+           "\"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f",
+           benchFirst ? "" : ",", r->name, r->n, r->total, r->total > 0 ? r->n / r->total : 0,
+           benchPercentile(r, 0.5), benchPercentile(r, 0.9), benchPercentile(r, 0.99), benchPercentile(r, 1));
+    if (r->bytes) printf(", \"mb_per_s\": %.1f", r->bytes / 1e6 / r->total);
+    if (r->items) printf(", \"items_per_s\": %.1f", r->items / r->total);
+    printf("}");
+    benchFirst = 0;
+    free(r->samples);
+}
+
+/**
+ * This function writes a log like file of about mb megabytes to path.
+ */
+void benchGenerate(const char *path, long mb) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) quit("fopen");
+    static const char *levels[] = {"INFO", "DEBUG", "WARN", "ERROR"};
+    long long size = 0;
+    unsigned seed = 1;
+    for (long j = 0; size < mb * 1000000; j++) {
+        seed = seed * 1103515245 + 12345;
+        int n = fprintf(fp, "2026-10-16 12:%02ld:%02ld.%03ld %s\trequest id=%08x took %ums path=/api/v1/items/%ld\n",
+                        j / 60000 % 60, j / 1000 % 60, j % 1000, levels[seed >> 30], seed, seed % 5000,
+                        j % 100000);
+        if (j % 97 == 0) n += fprintf(fp, "\n"); //some empty lines
+        size += n;
+    }
+    if (fclose(fp) == EOF) quit("fclose");
+}
+
+/**
+ * This function builds a whole frame into a memory buffer, the way refreshScreen() does, without
+ * writing it anywhere.
+ */
+void benchFrame() {
+    scroll();
+    shadowResize();
+    invalidateScreen();
+    for (int y = 0; y < E.shadowlines; y++) E.shadow[y].len = 0;
+    E.fullredraw = 0;
+    frameBuffer.len = 0;
+    drawField(&frameBuffer);
+    setStatusBar(&frameBuffer);
+    drawStatusBar(&frameBuffer);
+}
+
+/**
+ * This function runs one search like a key in the search prompt does and waits until the search
+ * thread has counted all matches.
+ */
+void benchSearch(benchResult *keystroke, benchResult *count, char *query, int key) {
+    E.cx = E.cy = 0;
+    double start = benchNow();
+    searchCallback(query, key);
+    benchAdd(keystroke, start);
+    while (E.search.running) {
+        searchPoll();
+        if (E.search.running) usleep(100);
+    }
+    benchAdd(count, start);
+    count->bytes += E.map ? (long long) E.mapsize : 0;
+    searchCallback(query, '\x1b');
+}
+
+int bench(int argc, char *argv[]) {
+    long mb = argc > 1 ? atol(argv[1]) : 1024;
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char path[4096], saved[4096];
+    snprintf(path, sizeof(path), "%s/teCS-bench-%d.txt", dir, (int) getpid());
+    snprintf(saved, sizeof(saved), "%s/teCS-bench-%d-saved.txt", dir, (int) getpid());
+    initializeEditor();
+    E.screenrows = 48;
+    E.screencols = 160;
+    srand(1);
+
+    benchGenerate(path, mb);
+    printf("{\"tool\": \"teCS-bench\", \"file_mb\": %ld, \"results\": [", mb);
+    benchResult first, load;
+    benchStart(&first, "load_first_screen");
+    benchStart(&load, "load_all_rows");
+    double start = benchNow();
+    readFile(path);
+    benchAdd(&first, start);
+    loaderFinish();
+    benchAdd(&load, start);
+    load.bytes = E.mapsize;
+    benchReport(&first);
+    benchReport(&load);
+
+    benchResult r;
+    benchStart(&r, "frame_random_scroll");
+    for (int j = 0; j < 2000; j++) {
+        E.cy = rand() % E.numrows;
+        start = benchNow();
+        benchFrame();
+        benchAdd(&r, start);
+    }
+    benchReport(&r);
+
+    benchStart(&r, "goto_byte_offset");
+    long long total = rowOffset(E.numrows);
+    for (int j = 0; j < 100000; j++) {
+        long long off = ((long long) rand() << 16 ^ rand()) % total;
+        int col;
+        start = benchNow();
+        E.cy = rowAtOffset(off, &col);
+        E.cx = col;
+        if (rowOffset(E.cy) + col != off) quit("rowAtOffset");
+        benchAdd(&r, start);
+    }
+    benchReport(&r);
+
+    benchStart(&r, "type_at_line_start");
+    for (int j = 0; j < 100000; j++) {
+        E.cy = rand() % E.numrows;
+        E.cx = 0;
+        start = benchNow();
+        undoBegin();
+        insertChar('x');
+        undoEnd();
+        benchAdd(&r, start);
+    }
+    benchReport(&r);
+
+    benchStart(&r, "type_run");
+    E.cy = E.numrows / 2;
+    E.cx = 0;
+    for (int j = 0; j < 100000; j++) {
+        start = benchNow();
+        undoBegin();
+        insertChar(j % 7 ? 'a' + j % 26 : ' ');
+        undoEnd();
+        benchAdd(&r, start);
+    }
+    benchReport(&r);
+
+    benchStart(&r, "delete_run");
+    for (int j = 0; j < 100000; j++) {
+        start = benchNow();
+        undoBegin();
+        deleteChar();
+        undoEnd();
+        benchAdd(&r, start);
+    }
+    benchReport(&r);
+
+    int pastelen = 0;
+    char *paste = malloc(1 << 20);
+    if (paste == NULL) quit("malloc");
+    while (pastelen < (1 << 20) - 100)
+        pastelen += snprintf(paste + pastelen, 100, "pasted line %d with some text\n", pastelen);
+    benchStart(&r, "paste_1mb");
+    for (int j = 0; j < 50; j++) {
+        E.cy = rand() % E.numrows;
+        E.cx = 0;
+        start = benchNow();
+        undoBegin();
+        insertText(paste, pastelen);
+        undoEnd();
+        benchAdd(&r, start);
+        r.bytes += pastelen;
+    }
+    benchReport(&r);
+
+    benchStart(&r, "undo_paste_1mb");
+    for (int j = 0; j < 50; j++) {
+        start = benchNow();
+        undoBegin();
+        undoStep(0);
+        undoEnd();
+        benchAdd(&r, start);
+        r.bytes += pastelen;
+    }
+    benchReport(&r);
+    free(paste);
+
+    benchResult count;
+    benchStart(&r, "search_literal_keystroke");
+    benchStart(&count, "search_literal_count");
+    char *queries[] = {"ERROR", "id=0000", "path=/api/v1/items/99999", "not in the file"};
+    for (int j = 0; j < 4; j++) benchSearch(&r, &count, queries[j], 0);
+    benchReport(&r);
+    benchReport(&count);
+
+    benchStart(&r, "search_regex_keystroke");
+    benchStart(&count, "search_regex_count");
+    char *patterns[] = {"took [0-9]+ms", "id=[0-9a-f]{8} took 4[0-9]{3}ms", "ERROR.*items/9+$", "[0-9]+zz"};
+    searchCallback("", CTRL_KEY('r')); //Ctrl-R toggles regex mode, it stays on for all patterns
+    for (int j = 0; j < 4; j++) benchSearch(&r, &count, patterns[j], 0);
+    searchCallback("", CTRL_KEY('r')); //leave regex mode
+    searchCallback("", '\x1b');
+    benchReport(&r);
+    benchReport(&count);
+
+    benchStart(&r, "replace_all");
+    benchStart(&count, "undo_replace_all");
+    char *replaces[][2] = {{"ERROR", "FAILURE"}, {"took ", ""}, {"/api/v1/", "/api/v2/"}, {"=", ""}};
+    for (int j = 0; j < 4; j++) {
+        int rows;
+        start = benchNow();
+        undoBegin();
+        r.items += replaceAll(replaces[j][0], replaces[j][1], &rows);
+        undoEnd();
+        benchAdd(&r, start);
+        r.bytes += E.mapsize;
+        start = benchNow();
+        undoBegin();
+        undoStep(0);
+        undoEnd();
+        benchAdd(&count, start);
+        if (*replaces[j][1] == '\0') { //redo and undo an empty replacement once more, they delete the matches
+            undoBegin();
+            undoStep(1);
+            undoStep(0);
+            undoEnd();
+        }
+    }
+    benchReport(&r);
+    benchReport(&count);
+
+    benchStart(&r, "row_to_string");
+    int len;
+    start = benchNow();
+    char *buf = rowToString(&len);
+    benchAdd(&r, start);
+    r.bytes = len;
+    free(buf);
+    benchReport(&r);
+
+    benchStart(&r, "save");
+    start = benchNow();
+    long long written = writeRows(saved);
+    benchAdd(&r, start);
+    if (written == -1) quit("writeRows");
+    r.bytes = written;
+    benchReport(&r);
+
+    printf("\n]}\n");
+    autosaveClose();
+    unlink(path);
+    unlink(saved);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    return bench(argc, argv);
+}
+#else
 /**
  * First we activate the unprocessed mode so we disable features of the terminal which we dont need.
  * After we initialize the editor with all its fields.
  * If we start the program with a ready to read file, it opens the file if not it creates and empty file.(unnamed)
  * After that we setup a help bar with important informations for handling our program.
  * After that we enter the infinite while loop which runs as long as we dont quit the program.
+ * With --trace out.json in front of the file name, spans of the session are written to out.json at exit.
+ * With --follow, lines appended to the file show up at its end like with tail -F.
  * @param argc number of parameters
  * @param argv name of the existing file
  */
 int main(int argc, char *argv[]) {
+    int arg = 1;
+    long cache = TECS_VIEW_CACHE;
+    while (arg < argc) {
+        if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+            traceStart(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--follow") == 0) {
+            E.follow.on = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--view") == 0) {
+            E.view.on = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--cache") == 0 && arg + 1 < argc && atol(argv[arg + 1]) > 0) {
+            cache = atol(argv[arg + 1]);
+            arg += 2;
+        } else {
+            break;
+        }
+    }
+    E.view.window = (size_t) cache << 19; //half of the cache in bytes
+    if (E.follow.on || argc != arg + 1) E.view.on = 0; //a view never changes and needs a file
+    setlocale(LC_CTYPE, ""); //once, the character classes of the terminal; numbers keep their decimal point
     activateUnprocessedMode();
     initializeEditor();
-    if (argc == 2) {
-        readFile(argv[1]);
+    if (windowSize(&E.screenrows, &E.screencols) == -1) quit("windowSize");
+    E.screenrows -= 2;
+    eventsInit();
+    infoBar();
+    if (argc == arg + 1) {
+        readFile(argv[arg]);
     }
-
-    time(&raw_time);
-    info = localtime(&raw_time);
-
-    char *s = concat("\U00002139: Ctrl-S   \U0001F4BE |Ctrl-Q   \U0001F6AB | Ctrl-F  \U0001F50D | \U000023F1 ",
-                     asctime(info));
-    setStatusMessage(s);
+    if (E.follow.on) followStart();
 
     while (1) {
         refreshScreen();
-        checkKeyPress();
+        do {
+            checkKeyPress();
+        } while (inputPending()); //handle all typed ahead keys before drawing again
+        textMaybeCompact();
     }
 }
-
+#endif